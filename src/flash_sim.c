@@ -0,0 +1,220 @@
+/*
+ * flash_sim.c
+ * @brief
+ * Created on: Oct 16, 2026
+ */
+#include "flash_sim.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stdio.h"
+
+static const flash_sim_timing_t default_timing = {
+    .command_ns = 640,
+    .byte_ns = 160,
+    .first_byte_us = 30,
+    .next_byte_ns = 2500,
+    .page_program_us = 700,
+    .sector_erase_us = 45000,
+    .block32_erase_us = 120000,
+    .block64_erase_us = 150000,
+};
+
+/**
+ * @brief 检查访问范围，越界时计一次违规
+ * @return true:访问范围有效
+ * */
+static bool sim_check(flash_sim_t *sim, uint32_t addr, uint32_t length) {
+    if((addr > sim->dev.size) || (length > (sim->dev.size - addr))) {
+        sim->violations++;
+        printf("flash::sim out of range %08x, length:%d\n", addr, length);
+        return false;
+    }
+    return true;
+}
+
+static void sim_read(flash_dev_t *dev, uint32_t addr, uint32_t length, uint8_t *buffer) {
+    flash_sim_t *sim = (flash_sim_t *)dev->context;
+    flash_sim_counter_t *counter;
+    uint32_t trunk;
+
+    if(length == 0) {
+        return;
+    }
+    if(!sim_check(sim, addr, length)) {
+        memset(buffer, 0xFF, length);
+        return;
+    }
+    memcpy(buffer, (sim->mem + addr), length);
+    sim->total.read_ops++;
+    sim->total.read_bytes += length;
+    sim->elapsed_ns += (sim->timing.command_ns + (uint64_t)length * sim->timing.byte_ns);
+    // 连续读取可以跨扇区，读取字节数计入各自的扇区
+    counter = &sim->sectors[addr / FLASH_SIM_SECTOR_SIZE];
+    counter->read_ops++;
+    while(length) {
+        trunk = FLASH_SIM_SECTOR_SIZE - (addr % FLASH_SIM_SECTOR_SIZE);
+        trunk = (length > trunk) ? trunk : length;
+        sim->sectors[addr / FLASH_SIM_SECTOR_SIZE].read_bytes += trunk;
+        addr += trunk;
+        length -= trunk;
+    }
+}
+
+/**
+ * @brief 页编程，只允许1->0
+ * @note 与芯片行为一致，超过页尾的数据回绕到页首编程，计一次违规；超过一页的数据只保留最后一页
+ *       编程耗时 = min(首字节耗时 + 后续字节数 * 每字节耗时, 整页编程耗时)
+ * */
+static void sim_write(flash_dev_t *dev, uint32_t addr, uint32_t length, const uint8_t *buffer) {
+    flash_sim_t *sim = (flash_sim_t *)dev->context;
+    flash_sim_counter_t *counter;
+    uint64_t program_ns;
+    uint32_t page = (addr - (addr % FLASH_SIM_PAGE_SIZE));
+    uint32_t target;
+
+    if((length == 0) || !sim_check(sim, addr, length)) {
+        return;
+    }
+    if(((addr % FLASH_SIM_PAGE_SIZE) + length) > FLASH_SIM_PAGE_SIZE) {
+        sim->violations++;
+        printf("flash::sim program crosses page %08x, length:%d\n", addr, length);
+    }
+    // 页缓冲只保留最后送入的一页数据
+    for(uint32_t i = ((length > FLASH_SIM_PAGE_SIZE) ? (length - FLASH_SIM_PAGE_SIZE) : 0); i < length; i++) {
+        target = page + ((addr + i) % FLASH_SIM_PAGE_SIZE);
+        if((sim->mem[target] & buffer[i]) != buffer[i]) {
+            sim->violations++;
+            printf("flash::sim program 0->1 at %08x: %02x -> %02x\n", target, sim->mem[target], buffer[i]);
+        }
+        sim->mem[target] &= buffer[i];
+    }
+    program_ns = ((uint64_t)sim->timing.first_byte_us * 1000 + (uint64_t)(length - 1) * sim->timing.next_byte_ns);
+    if(program_ns > ((uint64_t)sim->timing.page_program_us * 1000)) {
+        program_ns = ((uint64_t)sim->timing.page_program_us * 1000);
+    }
+    sim->elapsed_ns += (sim->timing.command_ns + (uint64_t)length * sim->timing.byte_ns + program_ns);
+
+    counter = &sim->sectors[page / FLASH_SIM_SECTOR_SIZE];
+    counter->program_ops++;
+    counter->program_bytes += length;
+    sim->total.program_ops++;
+    sim->total.program_bytes += length;
+}
+
+/**
+ * @brief 擦除，对齐的64KB/32KB范围使用块擦除，其余按4KB扇区擦除
+ * @note 地址或大小未对齐到扇区时计一次违规，实际擦除覆盖到的整个扇区(与芯片行为一致)
+ *       扇区计数中的erase_ops为该扇区被擦除的次数(磨损)，总计数中为擦除命令次数
+ * */
+static void sim_erase(flash_dev_t *dev, uint32_t addr, uint32_t size) {
+    flash_sim_t *sim = (flash_sim_t *)dev->context;
+    uint32_t end, trunk, erase_us;
+
+    if((size == 0) || !sim_check(sim, addr, size)) {
+        return;
+    }
+    if(((addr % FLASH_SIM_SECTOR_SIZE) != 0) || ((size % FLASH_SIM_SECTOR_SIZE) != 0)) {
+        sim->violations++;
+        printf("flash::sim unaligned erase %08x, size:%d\n", addr, size);
+    }
+    end = addr + size;
+    addr -= (addr % FLASH_SIM_SECTOR_SIZE);
+    end = ((end + FLASH_SIM_SECTOR_SIZE - 1) / FLASH_SIM_SECTOR_SIZE) * FLASH_SIM_SECTOR_SIZE;
+
+    while(addr < end) {
+        if(((addr % FLASH_SIM_BLOCK64_SIZE) == 0) && ((end - addr) >= FLASH_SIM_BLOCK64_SIZE)) {
+            trunk = FLASH_SIM_BLOCK64_SIZE;
+            erase_us = sim->timing.block64_erase_us;
+        }else if(((addr % FLASH_SIM_BLOCK32_SIZE) == 0) && ((end - addr) >= FLASH_SIM_BLOCK32_SIZE)) {
+            trunk = FLASH_SIM_BLOCK32_SIZE;
+            erase_us = sim->timing.block32_erase_us;
+        }else {
+            trunk = FLASH_SIM_SECTOR_SIZE;
+            erase_us = sim->timing.sector_erase_us;
+        }
+        memset((sim->mem + addr), 0xFF, trunk);
+        sim->elapsed_ns += (sim->timing.command_ns + (uint64_t)erase_us * 1000);
+        sim->total.erase_ops++;
+        for(uint32_t offset = 0; offset < trunk; offset += FLASH_SIM_SECTOR_SIZE) {
+            sim->sectors[(addr + offset) / FLASH_SIM_SECTOR_SIZE].erase_ops++;
+        }
+        addr += trunk;
+    }
+}
+
+/**
+ * @return 按时序模型累计的耗时(us)
+ * */
+static uint32_t sim_clock(flash_dev_t *dev) {
+    return (uint32_t)(((flash_sim_t *)dev->context)->elapsed_ns / 1000);
+}
+
+/**
+ * @brief 创建模拟器，初始内容为擦除状态，flash_tlv_init使用&sim->dev
+ * @note 模拟器不提供直接访问指针，保证所有读取都经过计数和时序模型
+ * @param size 容量(bytes)，对齐到FLASH_SIM_SECTOR_SIZE
+ * @param timing 时序参数，NULL时使用W25Q典型值
+ * @return true:创建成功
+ * */
+bool flash_sim_create(flash_sim_t *sim, uint32_t size, const flash_sim_timing_t *timing) {
+    uint32_t count = size / FLASH_SIM_SECTOR_SIZE;
+
+    if((size == 0) || ((size % FLASH_SIM_SECTOR_SIZE) != 0)) {
+        return false;
+    }
+    sim->mem = malloc(size);
+    sim->sectors = malloc(sizeof(flash_sim_counter_t) * count);
+    if((sim->mem == NULL) || (sim->sectors == NULL)) {
+        free(sim->mem);
+        free(sim->sectors);
+        return false;
+    }
+    memset(sim->mem, 0xFF, size);
+    sim->timing = (timing == NULL) ? default_timing : *timing;
+    sim->dev.read = sim_read;
+    sim->dev.write = sim_write;
+    sim->dev.erase = sim_erase;
+    sim->dev.pointer = NULL;
+    sim->dev.clock = sim_clock;
+    sim->dev.context = sim;
+    sim->dev.size = size;
+    flash_sim_reset(sim);
+    return true;
+}
+
+void flash_sim_delete(flash_sim_t *sim) {
+    free(sim->mem);
+    free(sim->sectors);
+    sim->mem = NULL;
+    sim->sectors = NULL;
+}
+
+/**
+ * @brief 清零所有计数和累计耗时，存储内容保持不变
+ * */
+void flash_sim_reset(flash_sim_t *sim) {
+    memset(&sim->total, 0x00, sizeof(flash_sim_counter_t));
+    memset(sim->sectors, 0x00, sizeof(flash_sim_counter_t) * (sim->dev.size / FLASH_SIM_SECTOR_SIZE));
+    sim->elapsed_ns = 0;
+    sim->violations = 0;
+}
+
+/**
+ * @brief 打印总计数、模拟耗时和有访问记录的扇区计数
+ * */
+void flash_sim_report(const flash_sim_t *sim) {
+    const flash_sim_counter_t *counter;
+    uint32_t count = sim->dev.size / FLASH_SIM_SECTOR_SIZE;
+
+    printf("flash::sim read:%u/%uB, program:%u/%uB, erase:%u, time:%.3fms, violations:%u\n",
+           sim->total.read_ops, sim->total.read_bytes, sim->total.program_ops, sim->total.program_bytes,
+           sim->total.erase_ops, (double)sim->elapsed_ns / 1e6, sim->violations);
+    for(uint32_t i = 0; i < count; i++) {
+        counter = &sim->sectors[i];
+        if((counter->read_ops | counter->program_ops | counter->erase_ops) == 0) {
+            continue;
+        }
+        printf("flash::sim sector %08x read:%u/%uB, program:%u/%uB, erase:%u\n", (i * FLASH_SIM_SECTOR_SIZE),
+               counter->read_ops, counter->read_bytes, counter->program_ops, counter->program_bytes, counter->erase_ops);
+    }
+}
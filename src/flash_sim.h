@@ -0,0 +1,76 @@
+/*
+ * flash_sim.h
+ * @brief NOR Flash模拟器后端，检查编程规则并统计每个扇区的读/编程/擦除次数，按时序模型累计耗时
+ * Created on: Oct 16, 2026
+ */
+
+#ifndef _FLASH_SIM_H_
+#define _FLASH_SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spi_flash.h"
+
+// 编程页大小，一次页编程不能跨页
+#define FLASH_SIM_PAGE_SIZE      256
+// 最小擦除单位(扇区)
+#define FLASH_SIM_SECTOR_SIZE    4096
+// 块擦除单位
+#define FLASH_SIM_BLOCK32_SIZE   0x8000
+#define FLASH_SIM_BLOCK64_SIZE   0x10000
+
+/**
+ * @brief 时序参数，默认值取W25Q系列数据手册典型值(50MHz单线SPI)
+ * */
+typedef struct _flash_sim_timing {
+    // 每条读/编程命令的指令+地址传输耗时(ns)
+    uint32_t command_ns;
+    // 每字节传输耗时(ns)
+    uint32_t byte_ns;
+    // 页内第一个字节的编程耗时(us)
+    uint32_t first_byte_us;
+    // 页内后续每字节的编程耗时(ns)
+    uint32_t next_byte_ns;
+    // 整页编程耗时上限(us)
+    uint32_t page_program_us;
+    // 4KB扇区、32KB块、64KB块擦除耗时(us)
+    uint32_t sector_erase_us;
+    uint32_t block32_erase_us;
+    uint32_t block64_erase_us;
+} flash_sim_timing_t;
+
+typedef struct _flash_sim_counter {
+    uint32_t read_ops;
+    uint32_t read_bytes;
+    // 页编程次数，跨页的写入按页拆分计数
+    uint32_t program_ops;
+    uint32_t program_bytes;
+    // 擦除命令次数，块擦除计一次
+    uint32_t erase_ops;
+} flash_sim_counter_t;
+
+typedef struct _flash_sim {
+    // 传给flash_tlv_init的后端接口，context指向模拟器本身
+    flash_dev_t dev;
+    flash_sim_timing_t timing;
+    uint8_t *mem;
+    // 所有扇区的累计计数
+    flash_sim_counter_t total;
+    // 每个4KB扇区的计数，数组长度为size / FLASH_SIM_SECTOR_SIZE
+    flash_sim_counter_t *sectors;
+    // 按时序模型累计的耗时(ns)
+    uint64_t elapsed_ns;
+    // 违反NOR规则的次数: 编程0->1、擦除地址未对齐、访问越界
+    uint32_t violations;
+} flash_sim_t;
+
+bool flash_sim_create(flash_sim_t *sim, uint32_t size, const flash_sim_timing_t *timing);
+
+void flash_sim_delete(flash_sim_t *sim);
+
+void flash_sim_reset(flash_sim_t *sim);
+
+void flash_sim_report(const flash_sim_t *sim);
+
+#endif
@@ -5,18 +5,194 @@
  * Author: Yanye
  */
 #include "flash_tlv.h"
-#include "spi_flash.h"
 #include "utils.h"
+#if FLASH_TLV_USE_COMPRESS
+#include "flash_tlv_lz.h"
+#endif
 #include "string.h"
+#include "stddef.h"
 #include "stdio.h"
 #include "stdbool.h"
-#if FLASH_TLV_USE_CACHE
-#include "flash_tlv_cache.h"
-#endif
 
 #define TLV_BLOCK_APPEND    0
 #define TLV_BLOCK_QUERY     1
 #define TLV_BLOCK_DELETE    2
+#define TLV_BLOCK_MARK      3
+
+#if FLASH_TLV_USE_CRC32
+typedef uint32_t record_crc_t;
+#define record_crc_update(crc, data, length)    calc_crc32c((crc), (data), (length))
+#define record_crc_stored(block)                ((block)->crc32)
+#define record_crc_offset                       offsetof(tlv_block_t, crc32)
+#else
+typedef uint8_t record_crc_t;
+#define record_crc_update(crc, data, length)    calc_crc8((crc), (data), (length))
+#define record_crc_stored(block)                ((block)->crc8)
+#define record_crc_offset                       offsetof(tlv_block_t, crc8)
+#endif
+
+// 保存完整值的记录头: 普通记录和压缩记录
+#if FLASH_TLV_USE_COMPRESS
+#define is_value(header)    (((header) == HEADER_VALID_TLV) || ((header) == HEADER_PACKED_TLV))
+#else
+#define is_value(header)    ((header) == HEADER_VALID_TLV)
+#endif
+
+/**
+ * @brief 页编程暂存区，连续写入的数据合并后按页边界编程
+ * */
+typedef struct _page_writer {
+    // 暂存区第一个字节对应的Flash地址
+    uint32_t address;
+    // 已暂存的字节数
+    uint32_t length;
+    uint8_t page[TLV_PAGE_SIZE];
+} page_writer_t;
+
+#if FLASH_TLV_USE_SUMMARY
+/**
+ * @brief 挂载摘要数据域的头部，之后是count个index_item_t
+ * @note 计数为写入摘要之前的值，挂载时从摘要记录本身开始重放工作扇区
+ * */
+typedef struct _tlv_summary {
+    // 写入时的最旧扇区序号，与挂载时不同说明之后又完成过整理，摘要作废
+    uint16_t oldest_index;
+    uint16_t count;
+    uint32_t live_bytes;
+    uint32_t dirty_bytes;
+    uint32_t dirty_blocks;
+#if FLASH_TLV_USE_DELTA
+    uint32_t delta_reserve;
+#endif
+} tlv_summary_t;
+#endif
+
+#if FLASH_TLV_USE_STREAM
+// 值头记录数据域的标识 "TLVS"
+#define TLV_STREAM_MAGIC    0x53564C54
+// 工作扇区剩余空间能放下的分段数据少于此值时启用新扇区，避免产生过小的分段
+#define TLV_PART_MIN        64
+// 单条分段记录的最大数据长度(不含分段头)，记录长度0xFFFF无效
+#define TLV_PART_MAX        (0xFFFE - sizeof(tlv_part_t))
+
+/**
+ * @brief 分段记录数据域的头部，之后是分段数据
+ * */
+typedef struct _tlv_part {
+    // 所属值的代号，与值头中的代号相同时分段有效
+    uint16_t gen;
+    // 分段在值中的序号，从0开始
+    uint16_t seq;
+} tlv_part_t;
+
+/**
+ * @brief 流式写入的值头，作为tag自身记录的数据域，flash_tlv_write_end写入后新值生效
+ * */
+typedef struct _tlv_stream_head {
+    uint32_t magic;
+    // 值的总长度(bytes)
+    uint32_t length;
+    // 整个值的CRC32C
+    uint32_t value_crc;
+    uint16_t gen;
+    // 分段数量
+    uint16_t parts;
+} tlv_stream_head_t;
+#endif
+
+#if FLASH_TLV_USE_DELTA
+/**
+ * @brief 增量记录数据域的头部，之后是补丁数据
+ * */
+typedef struct _tlv_delta {
+    // 链上前一条记录(完整记录或增量记录)的Meta域地址
+    uint32_t prev;
+    // 补丁在值中的偏移，不超过之前的值长度，等于时为在值末尾追加
+    uint16_t offset;
+    // 应用补丁后的值长度
+    uint16_t size;
+} tlv_delta_t;
+
+/**
+ * @brief 增量链中的一条记录
+ * */
+typedef struct _tlv_link {
+    // 记录Meta域地址
+    uint32_t address;
+    // 记录数据域长度
+    uint16_t length;
+    // 补丁在值中的偏移，完整记录为0
+    uint16_t offset;
+} tlv_link_t;
+
+/**
+ * @brief 从链头回溯得到的增量链
+ * */
+typedef struct _tlv_chain {
+    // links[0]为完整记录，之后按写入顺序排列增量记录
+    tlv_link_t links[TLV_DELTA_MAX + 1];
+    uint16_t count;
+    // 合并后的值长度
+    uint16_t size;
+    // links[0]为压缩记录，压缩记录之后不会链接增量记录
+    bool packed;
+} tlv_chain_t;
+
+/**
+ * @brief 修改时写入的补丁
+ * */
+typedef struct _tlv_patch {
+    uint16_t offset;
+    uint16_t length;
+    const uint8_t *data;
+} tlv_patch_t;
+#endif
+
+#if FLASH_TLV_USE_COMPRESS
+/**
+ * @brief 压缩记录数据域的头部，之后是LZSS压缩数据
+ * */
+typedef struct _tlv_pack {
+    // 原始值长度(bytes)
+    uint16_t length;
+} tlv_pack_t;
+
+/**
+ * @brief 压缩输出按页暂存写入Flash，同时累计记录校验值
+ * */
+typedef struct _pack_writer {
+    tlv_sector_t *sector;
+    page_writer_t writer;
+    record_crc_t crc;
+} pack_writer_t;
+
+/**
+ * @brief 解压时读取的压缩数据
+ * */
+typedef struct _pack_reader {
+    tlv_sector_t *sector;
+    // 压缩数据第一个字节的地址
+    uint32_t address;
+} pack_reader_t;
+#endif
+
+/**
+ * @brief flash_tlv_foreach的遍历参数
+ * */
+typedef struct _tlv_walk {
+    // tag范围[first, last]
+    uint16_t first;
+    uint16_t last;
+    // 数据域读取缓冲区，可以为NULL
+    uint8_t *buffer;
+    uint16_t size;
+    tlv_visit_t visit;
+    void *context;
+    // 遍历冷区时为热区存储，热区中存在的tag不再输出；遍历热区时为NULL
+    tlv_sector_t *shadow;
+    // 已调用回调的次数
+    uint32_t count;
+} tlv_walk_t;
 
 #define log_line(lfmt, ...)           \
     do {                              \
@@ -30,33 +206,382 @@
     #define log(...)
 #endif
 
-#if FLASH_TLV_USE_CACHE
-static cache_obj_t tlv_cache;
+static uint32_t sector_address(const tlv_sector_t *sector, uint16_t index);
+
+#if FLASH_TLV_USE_STATS
+#define stats_add(sector, field, value)    ((sector)->stats.field += (value))
+#define stats_begin(sector)                uint32_t stats_start = stats_clock(sector)
+#define stats_end(sector)                  stats_latency((sector), stats_start)
+
+static inline uint32_t stats_clock(tlv_sector_t *sector) {
+    return (sector->dev->clock != NULL) ? sector->dev->clock(sector->dev) : 0;
+}
+
+/**
+ * @brief 更新单次操作的最大耗时
+ * @param start 操作开始时的stats_clock
+ * */
+static void stats_latency(tlv_sector_t *sector, uint32_t start) {
+    uint32_t elapsed = (stats_clock(sector) - start);
+    if(elapsed > sector->stats.max_latency_us) {
+        sector->stats.max_latency_us = elapsed;
+    }
+}
+#else
+#define stats_add(sector, field, value)
+#define stats_begin(sector)
+#define stats_end(sector)
+#endif
+
+static inline void flash_read(tlv_sector_t *sector, uint32_t addr, uint32_t length, uint8_t *buffer) {
+    stats_add(sector, flash_reads, 1);
+    stats_add(sector, read_bytes, length);
+    sector->dev->read(sector->dev, addr, length, buffer);
+}
+
+/**
+ * @brief 编程Flash，跨越TLV_PAGE_SIZE页边界的数据按页拆分，NOR芯片一次页编程超过页尾会回绕到页首
+ * */
+static inline void flash_write(tlv_sector_t *sector, uint32_t addr, uint32_t length, const uint8_t *buffer) {
+    uint32_t trunk;
+
+    stats_add(sector, write_bytes, length);
+    while(length) {
+        trunk = TLV_PAGE_SIZE - (addr % TLV_PAGE_SIZE);
+        trunk = (length > trunk) ? trunk : length;
+        stats_add(sector, flash_writes, 1);
+        sector->dev->write(sector->dev, addr, trunk, buffer);
+        addr += trunk;
+        buffer += trunk;
+        length -= trunk;
+    }
+}
+
+static inline void flash_erase(tlv_sector_t *sector, uint32_t addr, uint32_t size) {
+    stats_add(sector, flash_erases, 1);
+    sector->dev->erase(sector->dev, addr, size);
+}
+
+#if FLASH_TLV_USE_LOCK
+// 设置了锁钩子时，读操作之间并发执行，读操作不修改缓存
+#define read_shared(sector)    ((sector)->lock.read_lock != NULL)
+
+static inline void lock_read(tlv_sector_t *sector) {
+    if(sector->lock.read_lock != NULL) {
+        sector->lock.read_lock(sector->lock.context);
+    }
+}
+
+static inline void unlock_read(tlv_sector_t *sector) {
+    if(sector->lock.read_unlock != NULL) {
+        sector->lock.read_unlock(sector->lock.context);
+    }
+}
+
+static inline void lock_write(tlv_sector_t *sector) {
+    if(sector->lock.write_lock != NULL) {
+        sector->lock.write_lock(sector->lock.context);
+    }
+}
+
+static inline void unlock_write(tlv_sector_t *sector) {
+    if(sector->lock.write_unlock != NULL) {
+        sector->lock.write_unlock(sector->lock.context);
+    }
+}
+#else
+#define read_shared(sector)    false
+#define lock_read(sector)
+#define unlock_read(sector)
+#define lock_write(sector)
+#define unlock_write(sector)
 #endif
 
+/**
+ * @brief 读取addr处的Meta域，后端支持直接访问时从映射地址复制，不经过驱动
+ * */
+static inline void read_meta(tlv_sector_t *sector, uint32_t addr, tlv_block_t *block) {
+    if(sector->dev->pointer != NULL) {
+        stats_add(sector, mapped_reads, 1);
+        memcpy(block, sector->dev->pointer(sector->dev, addr), TLV_MEAT_SIZE);
+        return;
+    }
+    flash_read(sector, addr, TLV_MEAT_SIZE, (uint8_t *)block);
+}
+
+/**
+ * @brief 记录校验值的起始部分，覆盖tag和length，之后继续计算数据域
+ * */
+static record_crc_t record_crc_begin(const tlv_block_t *block) {
+    record_crc_t crc;
+    crc = record_crc_update(0x00, (const uint8_t *)&block->tag, sizeof(uint16_t));
+    return record_crc_update(crc, (const uint8_t *)&block->length, sizeof(uint16_t));
+}
+
+static void erase_sector(tlv_sector_t *sector, uint32_t address);
+
+static bool mount_sector(tlv_sector_t *sector);
+
+static inline bool is_mounted(const tlv_sector_t *sector);
+
+static void read_begin(tlv_sector_t *sector);
+
 static tlv_err_t search_tlv(tlv_sector_t *sector, tlv_block_t *block, uint8_t flag);
 
 static uint32_t flash_tlv_gc(tlv_sector_t *sector);
 
+static uint16_t free_sectors(const tlv_sector_t *sector);
+
+static uint32_t free_space(tlv_sector_t *sector);
+
+static void gc_begin(tlv_sector_t *sector);
+
+static bool gc_run(tlv_sector_t *sector, uint16_t records);
+
+static bool make_space(tlv_sector_t *sector, uint32_t need);
+
+static void set_status(tlv_sector_t *sector, uint32_t address, uint8_t status);
+
+static void page_begin(page_writer_t *writer, uint32_t address);
+
+static void page_flush(tlv_sector_t *sector, page_writer_t *writer);
+
+static void make_meta(tlv_block_t *block, uint16_t header, const uint8_t *data);
+
+static void stage_record(tlv_sector_t *sector, page_writer_t *writer, tlv_block_t *block, uint16_t header,
+                         const uint8_t *data);
+
+static bool verify_record(tlv_sector_t *sector, const tlv_block_t *block, const uint8_t *data);
+
+static bool write_record(tlv_sector_t *sector, tlv_block_t *block, uint16_t header, const uint8_t *data);
+
+static void commit_record(tlv_sector_t *sector, tlv_block_t *block, const uint8_t *data);
+
+static bool append_tlv(tlv_sector_t *sector, uint16_t tag, const uint8_t *data, uint16_t length);
+
+static bool append_batch(tlv_sector_t *sector, const tlv_item_t *items, uint16_t count);
+
+static void format_sector(tlv_sector_t *sector);
+
+static bool query_tlv(tlv_sector_t *sector, uint16_t tag, tlv_block_t *block);
+
+static uint32_t read_tlv(tlv_sector_t *sector, tlv_block_t *block, uint8_t *buffer, uint16_t offset, uint16_t length);
+
+static bool read_value(tlv_sector_t *sector, const tlv_block_t *block, uint8_t *buffer, uint32_t offset,
+                       uint32_t length);
+
+static bool verify_tlv(tlv_sector_t *sector, tlv_block_t *block);
+
+static bool verify_data(tlv_sector_t *sector, const tlv_block_t *block);
+
+static uint16_t value_size(tlv_sector_t *sector, uint32_t address, const tlv_block_t *block);
+
+static bool gc_step(tlv_sector_t *sector, uint16_t records);
+
+static bool walk_tlv(tlv_sector_t *sector, tlv_walk_t *walk);
+
+#if FLASH_TLV_USE_SUMMARY
+static void write_summary(tlv_sector_t *sector);
+
+static bool load_summary(tlv_sector_t *sector);
+#endif
+
+#if FLASH_TLV_USE_SUMMARY
+static void invalidate_summary(tlv_sector_t *sector, uint32_t address);
+#else
+#define invalidate_summary(sector, address)
+#endif
+
+#if FLASH_TLV_USE_STREAM
+static bool stream_begin(tlv_sector_t *sector, tlv_stream_t *stream, uint16_t tag, uint32_t length);
+
+static bool stream_write(tlv_sector_t *sector, tlv_stream_t *stream, const uint8_t *data, uint32_t length);
+
+static bool stream_end(tlv_sector_t *sector, tlv_stream_t *stream);
+
+static void stream_abort(tlv_sector_t *sector, tlv_stream_t *stream);
+
+static bool find_head(tlv_sector_t *sector, uint16_t tag, tlv_stream_head_t *head);
+
+static uint32_t stream_read(tlv_sector_t *sector, tlv_stream_t *stream, uint8_t *buffer, uint32_t length);
+
+static bool part_live(tlv_sector_t *sector, uint32_t address, const tlv_block_t *block);
+
+static void drop_copied(tlv_sector_t *sector);
+#endif
+
+#if FLASH_TLV_USE_DELTA
+static bool load_chain(tlv_sector_t *sector, uint32_t address, tlv_chain_t *chain);
+
+static void drop_chain(tlv_sector_t *sector, const tlv_chain_t *chain);
+
+static bool scan_delta(tlv_sector_t *sector, uint32_t address, const tlv_block_t *block);
+
+static bool read_chain(tlv_sector_t *sector, const tlv_block_t *block, uint8_t *buffer, uint32_t offset,
+                       uint32_t length);
+
+static bool verify_chain(tlv_sector_t *sector, const tlv_block_t *block);
+
+static bool fold_chain(tlv_sector_t *sector, const tlv_chain_t *chain, uint16_t tag);
+
+static void fold_all(tlv_sector_t *sector);
+
+static bool patch_tlv(tlv_sector_t *sector, uint16_t tag, tlv_patch_t *patch, bool extend);
+#endif
+
+#if FLASH_TLV_USE_COMPRESS
+static bool append_packed(tlv_sector_t *sector, uint16_t tag, const uint8_t *data, uint16_t length);
+
+static bool unpack_value(tlv_sector_t *sector, uint32_t address, uint16_t stored, uint8_t *buffer, uint32_t offset,
+                         uint32_t length);
+
+static bool read_packed(tlv_sector_t *sector, const tlv_block_t *block, uint8_t *buffer, uint32_t offset,
+                        uint32_t length);
+
+static bool verify_packed(tlv_sector_t *sector, const tlv_block_t *block);
+#endif
+
+#if FLASH_TLV_USE_COLD
+static bool drop_cold(tlv_sector_t *sector, uint16_t tag);
+
+static bool move_cold(tlv_sector_t *sector, uint32_t address, tlv_block_t *block);
+#endif
+
 /**
  * @brief 初始化tlv存储扇区地址
- * @note major和minor扇区在记录中会交换使用
+ * @note major和minor扇区在记录中会交换使用，相当于2个扇区的环形日志
+ * @param dev 存储设备，可以是真实Flash驱动或模拟器
  * @param major 扇区1
  * @param minor 扇区2
- * @param size 扇区大小(bytes)
+ * @param size 扇区大小(bytes)，同时作为擦除块大小
  * */
-void flash_tlv_init(tlv_sector_t *sector, uint32_t major, uint32_t minor, uint16_t size) {
+void flash_tlv_init(tlv_sector_t *sector, flash_dev_t *dev, uint32_t major, uint32_t minor, uint32_t size) {
+    sector->dev = dev;
     sector->major_sector = major;
     sector->minor_sector = minor;
     sector->sector_size = size;
+    sector->erase_size = size;
+    sector->sector_count = 2;
+    sector->verify_mode = TLV_VERIFY_FULL;
 
     sector->work_sector = INVALID_ADDRESS;
+    sector->work_index = 0;
+    sector->oldest_index = 0;
+    sector->work_version = TLV_VERSION_MIN;
     sector->mark_address = 0;
+    sector->mark_length = 0;
     sector->dirty_blocks = 0;
+    sector->write_address = INVALID_ADDRESS;
+    sector->live_bytes = 0;
+    sector->dirty_bytes = 0;
+    sector->gc_address = INVALID_ADDRESS;
+    sector->gc_blocks = 0;
+#if FLASH_TLV_USE_INDEX
+    index_reset(&sector->index);
+#endif
+#if FLASH_TLV_USE_STATS
+    flash_tlv_stats_reset(sector);
+#endif
+#if FLASH_TLV_USE_LOCK
+    memset(&sector->lock, 0x00, sizeof(tlv_lock_t));
+#endif
 #if FLASH_TLV_USE_CACHE
-    invalidate_cache(&tlv_cache);
+    invalidate_cache(&sector->cache);
+#endif
+#if FLASH_TLV_USE_COLD
+    sector->cold = NULL;
+#endif
+#if FLASH_TLV_USE_SUMMARY
+    sector->summary_address = INVALID_ADDRESS;
+#endif
+#if FLASH_TLV_USE_STREAM
+    sector->stream = NULL;
+#endif
+#if FLASH_TLV_USE_DELTA
+    sector->delta_reserve = 0;
+#endif
+}
+
+/**
+ * @brief 初始化N个连续扇区组成的环形日志
+ * @note 新记录顺序写入工作扇区，写满后启用下一个空闲扇区；始终保留一个空闲扇区，
+ *       空间不足时只整理最旧的一个扇区，可用容量为(count - 1) / count
+ * @param base 第一个扇区地址，对齐到'size'
+ * @param count 扇区数量[2, TLV_SECTOR_MAX]
+ * @param size 扇区大小(bytes)
+ * */
+void flash_tlv_init_ring(tlv_sector_t *sector, flash_dev_t *dev, uint32_t base, uint16_t count, uint32_t size) {
+    flash_tlv_init(sector, dev, base, (base + size), size);
+    if(count < 2) {
+        count = 2;
+    }
+    sector->sector_count = (count > TLV_SECTOR_MAX) ? TLV_SECTOR_MAX : count;
+}
+
+/**
+ * @brief 设置物理擦除块大小，逻辑扇区由多个擦除块组成，需要在flash_tlv_init之后、首次访问之前调用
+ * @note 例如使用64KB逻辑扇区时，可以按芯片支持的32KB/64KB块擦除，也可以按4KB扇区擦除
+ * @param size 擦除块大小(bytes)，sector_size必须是它的整数倍
+ * @return true:设置成功
+ * */
+bool flash_tlv_set_erase_size(tlv_sector_t *sector, uint32_t size) {
+    if((size == 0) || (size > sector->sector_size) || ((sector->sector_size % size) != 0)) {
+        return false;
+    }
+    sector->erase_size = size;
+    return true;
+}
+
+/**
+ * @brief 设置追加记录后的校验方式，默认TLV_VERIFY_FULL
+ * @note TLV_VERIFY_CRC和TLV_VERIFY_FULL的回读量相同，但不再比较写入的数据；
+ *       TLV_VERIFY_NONE省去回读，编程失败的记录在下次挂载时按CRC8校验失败处理
+ * */
+void flash_tlv_set_verify(tlv_sector_t *sector, tlv_verify_t mode) {
+    sector->verify_mode = (uint8_t)mode;
+}
+
+#if FLASH_TLV_USE_LOCK
+/**
+ * @brief 设置读写锁钩子，多个任务访问同一存储时使用，需要在flash_tlv_init之后、首次访问之前调用
+ * @note 查询、读取、校验共享持有锁，互相并发；格式化、追加、删除、后台整理独占持有锁。
+ *       并发读时读操作不修改缓存(缓存只在追加时更新)，运行统计的计数可能丢失少量更新
+ * @param lock 锁钩子，内容被复制；NULL表示不加锁
+ * */
+void flash_tlv_set_lock(tlv_sector_t *sector, const tlv_lock_t *lock) {
+    if(lock == NULL) {
+        memset(&sector->lock, 0x00, sizeof(tlv_lock_t));
+        return;
+    }
+    sector->lock = *lock;
+}
+#endif
+
+#if FLASH_TLV_USE_COLD
+/**
+ * @brief 设置冷区，需要在flash_tlv_init之后、首次访问之前调用
+ * @note 冷区是另一个用flash_tlv_init/flash_tlv_init_ring初始化的存储，与本存储使用同一设备、地址不重叠；
+ *       热区整理时热度为0(连续多次整理期间没有更新)的记录移到冷区，查询先查热区再查冷区，
+ *       追加和删除同时作废冷区中的同tag记录。设置后只通过热区访问，冷区不能单独访问或设置锁。
+ *       冷区索引不完整时每次追加都会扫描冷区，冷区记录数应小于TLV_INDEX_MAX
+ * @param cold 冷区存储，NULL表示不使用冷区
+ * @return true:设置成功
+ * */
+bool flash_tlv_set_cold(tlv_sector_t *sector, tlv_sector_t *cold) {
+    if(cold != NULL) {
+        if((cold == sector) || (cold->dev != sector->dev) || (cold->cold != NULL)) {
+            return false;
+        }
+#if FLASH_TLV_USE_LOCK
+        if(cold->lock.write_lock != NULL) {
+            return false;
+        }
 #endif
+    }
+    sector->cold = cold;
+    return true;
 }
+#endif
 
 /**
  * @brief 格式化tlv占用的分区，用于物理擦除扇区内所有数据，需要先调用flash_tlv_init初始化tlv_sector_t
@@ -64,14 +589,51 @@ void flash_tlv_init(tlv_sector_t *sector, uint32_t major, uint32_t minor, uint16
  * @param sector tlv工作扇区
  * */
 void flash_tlv_format(tlv_sector_t *sector) {
+    lock_write(sector);
+    format_sector(sector);
+    unlock_write(sector);
+}
+
+/**
+ * @brief 格式化，见flash_tlv_format，同时格式化冷区，调用前需要持有独占锁
+ * */
+static void format_sector(tlv_sector_t *sector) {
     const uint32_t sector_header = (TLV_VERSION_MIN << 16) | TLV_SECTOR_TAG;
     // 只擦除数据区并写入有效头
-    flash_erase(sector->major_sector, sector->sector_size);
-    flash_erase(sector->minor_sector, sector->sector_size);
-    flash_write(sector->major_sector, sizeof(uint32_t), (uint8_t *)&sector_header);
+    for(uint16_t i = 0; i < sector->sector_count; i++) {
+        erase_sector(sector, sector_address(sector, i));
+    }
+    flash_write(sector, sector->major_sector, sizeof(uint32_t), (uint8_t *)&sector_header);
     sector->work_sector = sector->major_sector;
+    sector->work_index = 0;
+    sector->oldest_index = 0;
+    sector->work_version = TLV_VERSION_MIN;
+    sector->dirty_blocks = 0;
+    sector->write_address = (sector->major_sector + TLV_SECTOR_HEADER_SIZE);
+    sector->live_bytes = 0;
+    sector->dirty_bytes = 0;
+    sector->gc_address = INVALID_ADDRESS;
+    sector->gc_blocks = 0;
+#if FLASH_TLV_USE_INDEX
+    index_reset(&sector->index);
+#endif
 #if FLASH_TLV_USE_CACHE
-    invalidate_cache(&tlv_cache);
+    invalidate_cache(&sector->cache);
+#endif
+#if FLASH_TLV_USE_SUMMARY
+    sector->summary_address = INVALID_ADDRESS;
+#endif
+#if FLASH_TLV_USE_STREAM
+    // 进行中的流式写入作废，之后的flash_tlv_write_chunk/flash_tlv_write_end返回false
+    sector->stream = NULL;
+#endif
+#if FLASH_TLV_USE_DELTA
+    sector->delta_reserve = 0;
+#endif
+#if FLASH_TLV_USE_COLD
+    if(sector->cold != NULL) {
+        format_sector(sector->cold);
+    }
 #endif
 }
 
@@ -85,12 +647,60 @@ void flash_tlv_format(tlv_sector_t *sector) {
  * @return true: 写入成功, false: 空间不足写入失败
  * */
 bool flash_tlv_append(tlv_sector_t *sector, uint16_t tag, const uint8_t *data, uint16_t length) {
+    bool res;
+    lock_write(sector);
+    stats_begin(sector);
+    res = append_tlv(sector, tag, data, length);
+    stats_end(sector);
+    unlock_write(sector);
+    return res;
+}
+
+/**
+ * @brief 批量追加记录，整批记录要么全部生效，要么全部无效(掉电安全)
+ * @note 只查找一次空闲空间、做一次GC决策，整批记录写入同一扇区，记录顺序写入后再写入提交标记，
+ *       提交标记生效前掉电，整批记录作废；生效后掉电，下次挂载时补完整批记录
+ * @param sector tlv操作扇区
+ * @param items 写入的记录，允许出现重复tag，后面的记录生效
+ * @param count 记录条数
+ * @return true: 写入成功, false: 空间不足或写入失败，没有任何记录生效
+ * */
+bool flash_tlv_append_batch(tlv_sector_t *sector, const tlv_item_t *items, uint16_t count) {
+    bool res;
+    lock_write(sector);
+    stats_begin(sector);
+    res = append_batch(sector, items, count);
+    stats_end(sector);
+    unlock_write(sector);
+    return res;
+}
+
+#if FLASH_TLV_USE_COMPRESS
+/**
+ * @brief 压缩后追加一条记录，适合重复内容多的配置文本、表格等数据，其余与flash_tlv_append相同
+ * @note 压缩时在调用者的data中查找匹配，不需要额外的缓冲区；压缩后不能节省空间时按普通记录写入；
+ *       读取时从头解压到读取位置，flash_tlv_get_ptr返回NULL，修改压缩的值时写入未压缩的完整记录
+ * @param data 写入的数据
+ * @param length 数据的长度(bytes)
+ * @return true: 写入成功, false: 空间不足写入失败
+ * */
+bool flash_tlv_append_packed(tlv_sector_t *sector, uint16_t tag, const uint8_t *data, uint16_t length) {
+    bool res;
+    lock_write(sector);
+    stats_begin(sector);
+    res = append_packed(sector, tag, data, length);
+    stats_end(sector);
+    unlock_write(sector);
+    return res;
+}
+#endif
+
+/**
+ * @brief 追加一条记录，见flash_tlv_append
+ * */
+static bool append_tlv(tlv_sector_t *sector, uint16_t tag, const uint8_t *data, uint16_t length) {
     tlv_err_t status;
     tlv_block_t block;
-    uint32_t count;
-    uint32_t offset = 0;
-    uint8_t crc8;
-    uint8_t buffer[32];
 
     // 查找可用空间
     block.tag = tag;
@@ -99,8 +709,7 @@ bool flash_tlv_append(tlv_sector_t *sector, uint16_t tag, const uint8_t *data, u
     if(status == TLV_RESULT_OK) {
         goto LAB_WRITE_TLV;
     }
-    count = flash_tlv_gc(sector);
-    if(count < (TLV_MEAT_SIZE + length)) {
+    if((status != TLV_DATA_SPACE_LOW) || !make_space(sector, (TLV_MEAT_SIZE + length))) {
         return false;
     }
     status = search_tlv(sector, &block, TLV_BLOCK_APPEND);
@@ -109,124 +718,354 @@ bool flash_tlv_append(tlv_sector_t *sector, uint16_t tag, const uint8_t *data, u
     }
 
     LAB_WRITE_TLV:
-    // 计算CRC8
-    crc8 = calc_crc8(0x00, (const uint8_t *)&tag, sizeof(uint16_t));
-    crc8 = calc_crc8(crc8, (const uint8_t *)&length, sizeof(uint16_t));
-    crc8 = calc_crc8(crc8, data, length);
-
-    block.header = HEADER_VALID_TLV;
-    block.status = TLV_STATE_WRITE;
-    block.crc8 = crc8;
-    // 写入数据
-    flash_write(block.entity, TLV_MEAT_SIZE, (uint8_t *)&block);
-    flash_write(block.entity + TLV_MEAT_SIZE, length, data);
-    // 校验头部
-    flash_read(block.entity, TLV_MEAT_SIZE, buffer);
-    if(memcmp(buffer, (uint8_t *)&block, TLV_MEAT_SIZE) != 0) {
+    if(!write_record(sector, &block, HEADER_VALID_TLV, data)) {
         return false;
     }
-    // 校验数据域
-    do {
-        count = (length > 32) ? 32 : length;
-        flash_read((block.entity + TLV_MEAT_SIZE + offset), count, buffer);
-        if(memcmp(buffer, (data + offset), count) != 0) {
-            return false;
-        }
-        offset += count;
-        length -= count;
-    }while(length);
-
-    // 更新确认标记(1->0)，0xFE变成0xFC
-    buffer[0] = TLV_STATE_VERIFY;
-    flash_write((block.entity + 2), 1, buffer);
-    // entity域更新到实际数据域起始地址
-    block.entity += TLV_MEAT_SIZE;
-    // 删除上一条相同tag的记录(如果存在)
-    if(sector->mark_address != 0) {
-        buffer[0] = TLV_STATE_DELETE;
-        flash_write((sector->mark_address + 2), 1, buffer);
-        log("mark delete:0x%04x", block.tag);
-        sector->mark_address = 0;
-        sector->dirty_blocks++;
-    }
-    // 更新缓存
-#if FLASH_TLV_USE_CACHE
-    log("append: add to cache");
-    set_cache(&tlv_cache, tag, &block);
-#endif
+    commit_record(sector, &block, data);
     return true;
 }
 
 /**
- * @brief 查询指定标签的记录，如果启用了缓存，会先尝试从缓存取数据
- * @param sector 工作扇区
- * @param tag 被查询的标签
- * @param block 用于接收查询结果(仅在返回值为true时有值)
- * @return true:查询成功
+ * @brief 批量追加记录，见flash_tlv_append_batch
  * */
-bool flash_tlv_query(tlv_sector_t *sector, uint16_t tag, tlv_block_t *block) {
-    tlv_err_t err;
-#if FLASH_TLV_USE_CACHE
-    bool res = get_cache(&tlv_cache, tag, block);
+static bool append_batch(tlv_sector_t *sector, const tlv_item_t *items, uint16_t count) {
+    page_writer_t writer;
+    tlv_block_t block;
+    tlv_block_t commit;
+    uint32_t first, next;
+    uint32_t total = (TLV_MEAT_SIZE + sizeof(uint32_t));
+
+    if(count == 0) {
+        return true;
+    }
+    for(uint16_t i = 0; i < count; i++) {
+        total += (TLV_MEAT_SIZE + items[i].length);
+    }
+    if(!mount_sector(sector)) {
+        return false;
+    }
+    if(!make_space(sector, total)) {
+        return false;
+    }
+    // 第一阶段：整批记录和提交标记连续暂存按页编程，状态保持TLV_STATE_WRITE
+    first = sector->write_address;
+    page_begin(&writer, first);
+    for(uint16_t i = 0; i < count; i++) {
+        block.tag = items[i].tag;
+        block.length = items[i].length;
+        block.entity = sector->write_address;
+        stage_record(sector, &writer, &block, HEADER_VALID_TLV, items[i].data);
+    }
+    commit.tag = count;
+    commit.length = sizeof(uint32_t);
+    commit.entity = sector->write_address;
+    stage_record(sector, &writer, &commit, HEADER_COMMIT_TLV, (const uint8_t *)&first);
+    page_flush(sector, &writer);
+    // 全部回读校验通过后，提交标记状态变为TLV_STATE_VERIFY，整批记录生效
+    next = first;
+    for(uint16_t i = 0; i < count; i++) {
+        block.tag = items[i].tag;
+        block.length = items[i].length;
+        block.entity = next;
+        make_meta(&block, HEADER_VALID_TLV, items[i].data);
+        if(!verify_record(sector, &block, items[i].data)) {
+            return false;
+        }
+        next += (TLV_MEAT_SIZE + block.length);
+    }
+    if(!verify_record(sector, &commit, (const uint8_t *)&first)) {
+        return false;
+    }
+    set_status(sector, commit.entity, TLV_STATE_VERIFY);
+    // 第二阶段：逐条确认记录并标记旧记录删除
+    next = first;
+    for(uint16_t i = 0; i < count; i++) {
+        block.tag = items[i].tag;
+        block.length = items[i].length;
+        search_tlv(sector, &block, TLV_BLOCK_MARK);
+        block.entity = next;
+        commit_record(sector, &block, items[i].data);
+        next = (block.entity + block.length);
+    }
+    // 整批记录都已确认，提交标记作废
+    set_status(sector, commit.entity, TLV_STATE_DELETE);
+    sector->dirty_bytes += (TLV_MEAT_SIZE + commit.length);
+    sector->dirty_blocks++;
+    return true;
+}
+
+/**
+ * @brief 查询指定标签的记录，如果启用了缓存，会先尝试从缓存取数据，设置了冷区时热区未找到再查冷区
+ * @note 带有增量记录的值，block.length为合并后的值长度，block指向链头(header为HEADER_DELTA_TLV)，
+ *       flash_tlv_read读取时合并；压缩记录(header为HEADER_PACKED_TLV)的block.length为原始值长度
+ * @param sector 工作扇区
+ * @param tag 被查询的标签
+ * @param block 用于接收查询结果(仅在返回值为true时有值)
+ * @return true:查询成功
+ * */
+bool flash_tlv_query(tlv_sector_t *sector, uint16_t tag, tlv_block_t *block) {
+    bool res;
+    read_begin(sector);
+    res = query_tlv(sector, tag, block);
+    unlock_read(sector);
+    return res;
+}
+
+/**
+ * @brief 查询并读取记录的数据域，查询和读取在同一次加锁内完成，并发时读到的数据属于同一条记录
+ * @param tag 被查询的标签
+ * @param buffer 存放读取数据的缓冲区
+ * @param length 输入buffer大小，输出读取的字节数，数据域超出buffer的部分不读取
+ * @return true:查询成功
+ * */
+bool flash_tlv_get(tlv_sector_t *sector, uint16_t tag, uint8_t *buffer, uint16_t *length) {
+    tlv_block_t block;
+    bool res;
+
+    read_begin(sector);
+    res = query_tlv(sector, tag, &block);
+    if(res) {
+        *length = (block.length < *length) ? block.length : *length;
+        if(*length != 0) {
+            read_tlv(sector, &block, buffer, 0, *length);
+        }
+    }
+    unlock_read(sector);
+    return res;
+}
+
+/**
+ * @brief 查询指定标签的记录，见flash_tlv_query，调用前需要持有锁
+ * */
+static bool query_tlv(tlv_sector_t *sector, uint16_t tag, tlv_block_t *block) {
+    tlv_err_t err;
+    if(read_shared(sector) && !is_mounted(sector)) {
+        return false;
+    }
+#if FLASH_TLV_USE_CACHE
+    bool res = get_cache(&sector->cache, tag, block, !read_shared(sector));
     if(res) {
         log("fetch from cache");
+        stats_add(sector, cache_hits, 1);
         return true;
     }
+    stats_add(sector, cache_misses, 1);
 #endif
+    stats_begin(sector);
     block->tag = tag;
     err = search_tlv(sector, block, TLV_BLOCK_QUERY);
-#if FLASH_TLV_USE_CACHE
     if(err == TLV_RESULT_OK) {
+        block->length = value_size(sector, (block->entity - TLV_MEAT_SIZE), block);
+    }
+#if FLASH_TLV_USE_COLD
+    if((err == TLV_RESULT_NOT_FOUND) && (sector->cold != NULL)) {
+        // 冷区记录不放入热区缓存，冷区整理后缓存的地址会失效
+        err = search_tlv(sector->cold, block, TLV_BLOCK_QUERY);
+        if(err == TLV_RESULT_OK) {
+            block->length = value_size(sector->cold, (block->entity - TLV_MEAT_SIZE), block);
+        }
+        stats_end(sector);
+        return (err == TLV_RESULT_OK);
+    }
+#endif
+#if FLASH_TLV_USE_CACHE
+    if((err == TLV_RESULT_OK) && !read_shared(sector)) {
         log("query: add to cache");
-        set_cache(&tlv_cache, tag, block);
+        set_cache(&sector->cache, tag, block);
     }
 #endif
+    stats_end(sector);
     return (err == TLV_RESULT_OK);
 }
 
 /**
- * @brief 读取TLV结构的数据
+ * @brief 读取TLV结构的数据，启用数据域缓存时小记录从缓存读取
+ * @param sector 记录所在的tlv扇区
  * @param tlv flash_tlv_query查询得到的TVL结构
  * @param buffer 存放读取数据的缓冲区
  * @param offset TLV数据域偏移量 < tlv.length
  * @param length TLV数据域读取的长度 >= 1
  * @return 实际读取到的长度
  * */
-uint32_t flash_tlv_read(tlv_block_t *block, uint8_t *buffer, uint16_t offset, uint16_t length) {
+uint32_t flash_tlv_read(tlv_sector_t *sector, tlv_block_t *block, uint8_t *buffer, uint16_t offset, uint16_t length) {
+    uint32_t res;
+    lock_read(sector);
+    res = read_tlv(sector, block, buffer, offset, length);
+    unlock_read(sector);
+    return res;
+}
+
+/**
+ * @brief 读取记录的数据域，见flash_tlv_read，调用前需要持有锁
+ * */
+static uint32_t read_tlv(tlv_sector_t *sector, tlv_block_t *block, uint8_t *buffer, uint16_t offset, uint16_t length) {
     if(offset >= block->length) {
         return 0;
     }
     if((offset + length) > block->length) {
         return 0;
     }
-    flash_read(block->entity + offset, length, buffer);
+#if FLASH_TLV_USE_VALUE_CACHE
+    if(get_value(&sector->cache, block, buffer, offset, length, !read_shared(sector))) {
+        stats_add(sector, value_hits, 1);
+        return length;
+    }
+    stats_add(sector, value_misses, 1);
+    if((block->length <= TLV_VALUE_ITEM_MAX) && !read_shared(sector)) {
+        // 小记录整体读出并缓存
+        uint8_t value[TLV_VALUE_ITEM_MAX];
+        if(!read_value(sector, block, value, 0, block->length)) {
+            return 0;
+        }
+        set_value(&sector->cache, block, value);
+        memcpy(buffer, (value + offset), length);
+        return length;
+    }
+#endif
+    if(!read_value(sector, block, buffer, offset, length)) {
+        return 0;
+    }
     return length;
 }
 
 /**
- * @brief 验证flash_tlv_query获取到的TLV记录块完整性，使用CRC8
- * @note 验证操作是可选的
+ * @brief 从Flash读取数据域[offset, offset + length)，增量链的链头按合并后的值读取，压缩记录解压后读取
+ * @return false:增量链或压缩数据已损坏(block在整理或更新之后已过期)
+ * */
+static bool read_value(tlv_sector_t *sector, const tlv_block_t *block, uint8_t *buffer, uint32_t offset,
+                       uint32_t length) {
+#if FLASH_TLV_USE_DELTA
+    if(block->header == HEADER_DELTA_TLV) {
+        return read_chain(sector, block, buffer, offset, length);
+    }
+#endif
+#if FLASH_TLV_USE_COMPRESS
+    if(block->header == HEADER_PACKED_TLV) {
+        return read_packed(sector, block, buffer, offset, length);
+    }
+#endif
+    flash_read(sector, block->entity + offset, length, buffer);
+    return true;
+}
+
+/**
+ * @brief 以address处的记录为值时值的长度: 增量记录从数据域头部读取合并后的长度，压缩记录读取原始值长度
+ * @param address 记录Meta域地址
+ * */
+static uint16_t value_size(tlv_sector_t *sector, uint32_t address, const tlv_block_t *block) {
+#if FLASH_TLV_USE_DELTA
+    tlv_delta_t delta;
+    if(block->header == HEADER_DELTA_TLV) {
+        flash_read(sector, (address + TLV_MEAT_SIZE), sizeof(tlv_delta_t), (uint8_t *)&delta);
+        return delta.size;
+    }
+#endif
+#if FLASH_TLV_USE_COMPRESS
+    tlv_pack_t pack;
+    if(block->header == HEADER_PACKED_TLV) {
+        flash_read(sector, (address + TLV_MEAT_SIZE), sizeof(tlv_pack_t), (uint8_t *)&pack);
+        return pack.length;
+    }
+#endif
+#if !FLASH_TLV_USE_DELTA && !FLASH_TLV_USE_COMPRESS
+    (void)sector;
+    (void)address;
+#endif
+    return block->length;
+}
+
+/**
+ * @brief 获取记录数据域的直接访问指针，不复制数据，需要后端支持直接访问(片内Flash、XIP、内存映射文件)
+ * @note 指针指向Flash存储区，只读；记录被更新、删除或整理后指向的内容失效；
+ *       带有增量记录的值在Flash中不连续、压缩记录需要解压，都返回NULL
+ * @param tlv flash_tlv_query查询得到的TVL结构
+ * @param length 输出数据域长度，可以为NULL
+ * @return 数据域首地址，后端不支持直接访问时返回NULL，此时使用flash_tlv_read
+ * */
+const uint8_t *flash_tlv_get_ptr(tlv_sector_t *sector, const tlv_block_t *block, uint16_t *length) {
+    if(sector->dev->pointer == NULL) {
+        return NULL;
+    }
+#if FLASH_TLV_USE_DELTA
+    if(block->header == HEADER_DELTA_TLV) {
+        return NULL;
+    }
+#endif
+#if FLASH_TLV_USE_COMPRESS
+    if(block->header == HEADER_PACKED_TLV) {
+        return NULL;
+    }
+#endif
+    if(length != NULL) {
+        *length = block->length;
+    }
+    stats_add(sector, mapped_reads, 1);
+    return sector->dev->pointer(sector->dev, block->entity);
+}
+
+/**
+ * @brief 验证flash_tlv_query获取到的TLV记录块完整性，使用CRC8或CRC32C(FLASH_TLV_USE_CRC32)
+ * @note 验证操作是可选的，数据域已缓存时直接校验缓存内容，带有增量记录的值逐条校验链上的记录，
+ *       压缩记录校验存储的压缩数据
+ * @param sector 记录所在的tlv扇区
  * @param block 被验证的TLV数据块
  * */
-bool flash_tlv_verify(tlv_block_t *block) {
-    uint8_t crc8;
-    uint8_t buffer[32];
+bool flash_tlv_verify(tlv_sector_t *sector, tlv_block_t *block) {
+    bool res;
+    lock_read(sector);
+    res = verify_tlv(sector, block);
+    unlock_read(sector);
+    return res;
+}
+
+/**
+ * @brief 校验记录，见flash_tlv_verify，调用前需要持有锁
+ * */
+static bool verify_tlv(tlv_sector_t *sector, tlv_block_t *block) {
+#if FLASH_TLV_USE_DELTA
+    if(block->header == HEADER_DELTA_TLV) {
+        return verify_chain(sector, block);
+    }
+#endif
+#if FLASH_TLV_USE_COMPRESS
+    if(block->header == HEADER_PACKED_TLV) {
+        return verify_packed(sector, block);
+    }
+#endif
+#if FLASH_TLV_USE_VALUE_CACHE
+    // 数据域已缓存时不读Flash
+    uint32_t length = block->length;
+    uint8_t value[TLV_VALUE_ITEM_MAX];
+    // Tag and length
+    record_crc_t crc = record_crc_begin(block);
+    if((length <= TLV_VALUE_ITEM_MAX) && get_value(&sector->cache, block, value, 0, length, !read_shared(sector))) {
+        crc = record_crc_update(crc, value, length);
+        return (record_crc_stored(block) == crc);
+    }
+#endif
+    return verify_data(sector, block);
+}
+
+/**
+ * @brief 从Flash读取记录的数据域计算校验值，与Meta域中的校验值比较
+ * */
+static bool verify_data(tlv_sector_t *sector, const tlv_block_t *block) {
+    record_crc_t crc;
+    uint8_t buffer[FLASH_TLV_BUFFER_SIZE];
     uint32_t trunk, offset = 0;
     uint32_t length = block->length;
     // Tag and length
-    memcpy(buffer, &(block->tag), sizeof(uint16_t));
-    memcpy(buffer + 2, &(block->length), sizeof(uint16_t));
-    crc8 = calc_crc8(0x00, buffer, 4);
+    crc = record_crc_begin(block);
     // data
     do {
-        trunk = (length > 32) ? 32 : length;
-        flash_read((block->entity  + offset), trunk, buffer);
-        crc8 = calc_crc8(crc8, buffer, trunk);
+        trunk = (length > FLASH_TLV_BUFFER_SIZE) ? FLASH_TLV_BUFFER_SIZE : length;
+        flash_read(sector, (block->entity  + offset), trunk, buffer);
+        crc = record_crc_update(crc, buffer, trunk);
         offset += trunk;
         length -= trunk;
     }while(length);
 
-    return (block->crc8 == crc8);
+    return (record_crc_stored(block) == crc);
 }
 
 /**
@@ -236,55 +1075,387 @@ bool flash_tlv_verify(tlv_block_t *block) {
 bool flash_tlv_delete(tlv_sector_t *sector, uint16_t tag) {
     tlv_err_t err;
     tlv_block_t block;
+    bool cold = false;
+    lock_write(sector);
 #if FLASH_TLV_USE_CACHE
-    remove_cache(&tlv_cache, tag);
+    remove_cache(&sector->cache, tag);
+#endif
+    stats_begin(sector);
+#if FLASH_TLV_USE_COLD
+    cold = drop_cold(sector, tag);
 #endif
     block.tag = tag;
     err = search_tlv(sector, &block, TLV_BLOCK_DELETE);
-    return (err == TLV_RESULT_OK);
+    stats_end(sector);
+    unlock_write(sector);
+    return ((err == TLV_RESULT_OK) || cold);
+}
+
+#if FLASH_TLV_USE_DELTA
+/**
+ * @brief 改写tag的值中从offset开始的length字节，只写入记录补丁的增量记录，不重写整个值
+ * @note 读取时自动合并，整理时或增量记录达到TLV_DELTA_MAX条时折叠为完整记录；超出值末尾的部分使值变长；
+ *       tag不存在时只允许offset为0(相当于flash_tlv_append)；值不在热区索引中(冷区、索引已满)时直接写入合并后的完整记录
+ * @param offset 补丁在值中的偏移 <= 当前值长度
+ * @param data 补丁数据
+ * @param length 补丁长度 >= 1
+ * @return true:写入成功, false:偏移或合并后的长度超出范围、空间不足或写入失败
+ * */
+bool flash_tlv_patch(tlv_sector_t *sector, uint16_t tag, uint16_t offset, const uint8_t *data, uint16_t length) {
+    tlv_patch_t patch;
+    bool res;
+    patch.offset = offset;
+    patch.length = length;
+    patch.data = data;
+    lock_write(sector);
+    stats_begin(sector);
+    res = patch_tlv(sector, tag, &patch, false);
+    stats_end(sector);
+    unlock_write(sector);
+    return res;
+}
+
+/**
+ * @brief 在tag的值末尾追加length字节，适合只增长的日志类数据，见flash_tlv_patch
+ * @note tag不存在时以data作为新值
+ * */
+bool flash_tlv_extend(tlv_sector_t *sector, uint16_t tag, const uint8_t *data, uint16_t length) {
+    tlv_patch_t patch;
+    bool res;
+    patch.offset = 0;
+    patch.length = length;
+    patch.data = data;
+    lock_write(sector);
+    stats_begin(sector);
+    res = patch_tlv(sector, tag, &patch, true);
+    stats_end(sector);
+    unlock_write(sector);
+    return res;
+}
+#endif
+
+/**
+ * @brief 遍历tag在[first, last]范围内的有效记录，代替逐个tag查询来导出/同步全部记录
+ * @note 索引完整时按索引升序访问范围内的记录，否则从最旧扇区到写入地址顺序扫描一次(按写入顺序输出)；
+ *       设置了冷区时热区之后遍历冷区。遍历期间持有锁，回调中不能调用本存储的其他接口
+ * @param first tag下限(包含)
+ * @param last tag上限(包含)，遍历全部记录时为0x0000, 0xFFFF
+ * @param buffer 非NULL时每条记录的数据域先读到buffer再调用回调，超出size的部分不读取
+ * @param size buffer大小(bytes)
+ * @param visit 回调，返回false时停止遍历
+ * @return 调用回调的次数
+ * */
+uint32_t flash_tlv_foreach(tlv_sector_t *sector, uint16_t first, uint16_t last, uint8_t *buffer, uint16_t size,
+                           tlv_visit_t visit, void *context) {
+    tlv_walk_t walk;
+
+    walk.first = first;
+    walk.last = last;
+    walk.buffer = (size != 0) ? buffer : NULL;
+    walk.size = size;
+    walk.visit = visit;
+    walk.context = context;
+    walk.shadow = NULL;
+    walk.count = 0;
+    read_begin(sector);
+    stats_begin(sector);
+    if(is_mounted(sector) && walk_tlv(sector, &walk)) {
+#if FLASH_TLV_USE_COLD
+        if(sector->cold != NULL) {
+            walk.shadow = sector;
+            walk_tlv(sector->cold, &walk);
+        }
+#endif
+    }
+    stats_end(sector);
+    unlock_read(sector);
+    return walk.count;
+}
+
+/**
+ * @brief 后台整理，每次最多处理records条记录，供空闲任务周期调用，避免追加记录时整理整个扇区
+ * @note 没有进行中的整理时，只有工作扇区可用空间低于1/TLV_GC_FREE_RATIO且存在无效数据才开始整理；
+ *       整理进度保存在gc_address，已复制的原记录立即标记删除，掉电后重新整理时会跳过
+ * @param sector tlv操作扇区
+ * @param records 本次最多处理的记录数(含Meta域异常块) >= 1
+ * @return true: 整理尚未完成，需要继续调用, false: 没有需要整理的扇区
+ * */
+bool flash_tlv_gc_step(tlv_sector_t *sector, uint16_t records) {
+    bool res;
+    lock_write(sector);
+    res = gc_step(sector, records);
+    unlock_write(sector);
+    return res;
+}
+
+/**
+ * @brief 后台整理，见flash_tlv_gc_step，调用前需要持有独占锁
+ * */
+static bool gc_step(tlv_sector_t *sector, uint16_t records) {
+    if(!mount_sector(sector)) {
+        return false;
+    }
+    stats_begin(sector);
+    if(sector->gc_address == INVALID_ADDRESS) {
+        if((sector->dirty_bytes == 0) || (free_sectors(sector) > 1) ||
+           (free_space(sector) >= ((sector->sector_size - TLV_SECTOR_HEADER_SIZE) / TLV_GC_FREE_RATIO))) {
+            return false;
+        }
+        gc_begin(sector);
+    }
+    gc_run(sector, records);
+#if FLASH_TLV_USE_STATS
+    stats_add(sector, gc_time_us, (stats_clock(sector) - stats_start));
+#endif
+    stats_end(sector);
+    return (sector->gc_address != INVALID_ADDRESS);
+}
+
+#if FLASH_TLV_USE_STREAM
+/**
+ * @brief 开始流式写入tag的值，值的内容由flash_tlv_write_chunk分多次提供，不需要在RAM中暂存整个值
+ * @note 值拆分为多条分段记录顺序写入，每条分段不超过工作扇区的剩余空间，值可以跨越多个扇区；
+ *       flash_tlv_write_end写入值头记录后新值才生效，之前掉电或写入失败时旧值不变。
+ *       值头作为tag自身的记录，flash_tlv_query/flash_tlv_foreach得到的是值头，值的内容通过flash_tlv_read_begin读取；
+ *       之后用flash_tlv_append覆盖或flash_tlv_delete删除时，旧分段在整理时回收。
+ *       同一存储同时只能有一个进行中的流式写入；写入期间可以调用其他接口，但它们触发的整理回收了
+ *       当前分段所在的扇区时本次写入失败。开始和结束时各扫描一次存储，作废该tag残留的旧分段
+ * @param stream 写入状态，调用者分配，写入结束前保持有效
+ * @param tag 写入的标签
+ * @param length 值的总长度(bytes)
+ * @return true:可以开始写入，false:已有进行中的流式写入或没有有效扇区
+ * */
+bool flash_tlv_write_begin(tlv_sector_t *sector, tlv_stream_t *stream, uint16_t tag, uint32_t length) {
+    bool res;
+    lock_write(sector);
+    stats_begin(sector);
+    res = stream_begin(sector, stream, tag, length);
+    stats_end(sector);
+    unlock_write(sector);
+    return res;
+}
+
+/**
+ * @brief 写入值的下一段内容，直接编程到当前分段记录，分段写满时确认该分段并在需要时打开下一个分段
+ * @note 分段的记录校验值随写入增量计算，分段写满后再写入Meta域
+ * @param data 写入的数据
+ * @param length 数据的长度(bytes)，累计不能超过flash_tlv_write_begin的length
+ * @return true:写入成功，false:空间不足、校验失败或超出值的长度，本次流式写入已放弃，旧值不变
+ * */
+bool flash_tlv_write_chunk(tlv_stream_t *stream, const uint8_t *data, uint32_t length) {
+    tlv_sector_t *sector = stream->sector;
+    bool res;
+    lock_write(sector);
+    stats_begin(sector);
+    res = stream_write(sector, stream, data, length);
+    if(!res) {
+        stream_abort(sector, stream);
+    }
+    stats_end(sector);
+    unlock_write(sector);
+    return res;
+}
+
+/**
+ * @brief 结束流式写入，写入值头记录使新值生效，同时作废该tag旧值的分段
+ * @note 写入的数据不足flash_tlv_write_begin的length时放弃本次写入；需要中途放弃时也调用此函数
+ * @return true:新值已生效，false:本次流式写入已放弃，旧值不变
+ * */
+bool flash_tlv_write_end(tlv_stream_t *stream) {
+    tlv_sector_t *sector = stream->sector;
+    bool res;
+    lock_write(sector);
+    stats_begin(sector);
+    res = stream_end(sector, stream);
+    if(!res) {
+        stream_abort(sector, stream);
+    }
+    stats_end(sector);
+    unlock_write(sector);
+    return res;
+}
+
+/**
+ * @brief 开始流式读取flash_tlv_write_begin写入的值
+ * @note 读取期间不持有锁，值被覆盖或删除后读取失败；分段被整理移动后按序号重新查找
+ * @param stream 读取状态，调用者分配
+ * @param tag 被读取的标签
+ * @return true:tag存在且是流式写入的值，值的长度为stream->length
+ * */
+bool flash_tlv_read_begin(tlv_sector_t *sector, tlv_stream_t *stream, uint16_t tag) {
+    tlv_stream_head_t head;
+    bool res;
+
+    read_begin(sector);
+    res = (is_mounted(sector) && find_head(sector, tag, &head));
+    unlock_read(sector);
+    if(!res) {
+        return false;
+    }
+    stream->sector = sector;
+    stream->tag = tag;
+    stream->gen = head.gen;
+    stream->length = head.length;
+    stream->offset = 0;
+    stream->crc = 0;
+    stream->value_crc = head.value_crc;
+    stream->part_address = INVALID_ADDRESS;
+    stream->part_seq = 0;
+    stream->part_length = 0;
+    stream->part_offset = 0;
+    stream->part_version = 0;
+    stream->part_crc = 0;
+    return true;
+}
+
+/**
+ * @brief 读取值的下一段内容，同时累计CRC32C
+ * @note 每个分段第一次读取时从最旧扇区扫描查找一次
+ * @param buffer 存放读取数据的缓冲区
+ * @param length buffer大小(bytes)
+ * @return 实际读取的字节数，读到值的末尾时小于length，分段丢失时返回0
+ * */
+uint32_t flash_tlv_read_chunk(tlv_stream_t *stream, uint8_t *buffer, uint32_t length) {
+    tlv_sector_t *sector = stream->sector;
+    uint32_t res = 0;
+
+    read_begin(sector);
+    if(is_mounted(sector)) {
+        res = stream_read(sector, stream, buffer, length);
+    }
+    unlock_read(sector);
+    return res;
+}
+
+/**
+ * @brief 结束流式读取
+ * @return true:值已全部读取且CRC32C与写入时一致
+ * */
+bool flash_tlv_read_end(const tlv_stream_t *stream) {
+    return ((stream->offset == stream->length) && (stream->crc == stream->value_crc));
+}
+#endif
+
+#if FLASH_TLV_USE_STATS
+/**
+ * @brief 获取运行统计，同时填充当前有效/无效/可用字节数
+ * @note 可用字节数包括工作扇区剩余空间和空闲扇区(保留的一个空闲扇区除外)
+ * @param stats 接收统计结果
+ * */
+void flash_tlv_stats(tlv_sector_t *sector, tlv_stats_t *stats) {
+    uint16_t count;
+    lock_read(sector);
+    *stats = sector->stats;
+    stats->live_bytes = sector->live_bytes;
+    stats->dirty_bytes = sector->dirty_bytes;
+    stats->free_bytes = 0;
+    if(is_mounted(sector)) {
+        count = free_sectors(sector);
+        stats->free_bytes = free_space(sector);
+        if(count > 1) {
+            stats->free_bytes += ((count - 1) * (sector->sector_size - TLV_SECTOR_HEADER_SIZE));
+        }
+    }
+    unlock_read(sector);
+}
+
+/**
+ * @brief 清零运行统计
+ * */
+void flash_tlv_stats_reset(tlv_sector_t *sector) {
+    memset(&sector->stats, 0x00, sizeof(tlv_stats_t));
+}
+#endif
+
+/**
+ * @brief 获取第index个扇区的地址
+ * */
+static uint32_t sector_address(const tlv_sector_t *sector, uint16_t index) {
+    if(index == 0) {
+        return sector->major_sector;
+    }
+    if(index == 1) {
+        return sector->minor_sector;
+    }
+    return (sector->major_sector + (uint32_t)index * sector->sector_size);
+}
+
+/**
+ * @brief 按擦除块大小逐块擦除一个逻辑扇区
+ * @param address 扇区地址
+ * */
+static void erase_sector(tlv_sector_t *sector, uint32_t address) {
+    for(uint32_t offset = 0; offset < sector->sector_size; offset += sector->erase_size) {
+        flash_erase(sector, (address + offset), sector->erase_size);
+    }
+}
+
+static inline uint16_t next_index(const tlv_sector_t *sector, uint16_t index) {
+    return ((index + 1) == sector->sector_count) ? 0 : (index + 1);
+}
+
+static inline uint16_t prev_index(const tlv_sector_t *sector, uint16_t index) {
+    return (index == 0) ? (sector->sector_count - 1) : (index - 1);
+}
+
+/**
+ * @return 空闲(未启用)扇区数量
+ * */
+static uint16_t free_sectors(const tlv_sector_t *sector) {
+    uint16_t used = ((sector->work_index + sector->sector_count - sector->oldest_index) % sector->sector_count) + 1;
+    return (sector->sector_count - used);
 }
 
 /**
  * 查找当前有效的工作扇区
- * @param tlv_sec major_sector和minor_sector必须配置完成，work_sector填充初值0xFFFFFFFF
+ * @param tlv_sec 扇区地址必须配置完成，work_sector填充初值0xFFFFFFFF
  * @note 调用flash_tlv_init完成tlv_sec结构初始化
+ *       版本号按序列号比较(允许回绕)，最新的扇区为工作扇区，
+ *       从工作扇区沿环向前，版本号连续的有效扇区属于同一日志，其余扇区视为空闲
  * @return true:找到有效工作扇区
  * */
 static bool find_valid_sector(tlv_sector_t *tlv_sec) {
-    tlv_sector_header_t  header_major;
-    tlv_sector_header_t  header_minor;
-
-    flash_read(tlv_sec->major_sector, TLV_SECTOR_HEADER_SIZE, (uint8_t *)&header_major);
-    flash_read(tlv_sec->minor_sector, TLV_SECTOR_HEADER_SIZE, (uint8_t *)&header_minor);
-
-    if((header_major.tag == TLV_SECTOR_TAG) && (header_minor.tag == TLV_SECTOR_TAG)) {
-        if(header_major.version == TLV_VERSION_MAX && header_minor.version == TLV_VERSION_MIN) {
-            // 优化分支，避免GC完成后擦除一次旧主扇区
-            tlv_sec->work_sector = tlv_sec->minor_sector;
-        }else if(header_major.version == TLV_VERSION_MIN && header_minor.version == TLV_VERSION_MAX) {
-            // 优化分支，避免GC完成后擦除一次旧主扇区
-            tlv_sec->work_sector = tlv_sec->major_sector;
-        }else {
-            // 都有TLV_SECTOR_TAG, 取版本号大的为主分区
-            tlv_sec->work_sector = (header_major.version > header_minor.version) ?
-                    tlv_sec->major_sector : tlv_sec->minor_sector;
-        }
-    }else if((header_major.tag != TLV_SECTOR_TAG) && (header_minor.tag != TLV_SECTOR_TAG)) {
-        // 两个分区tag都无效时，全部格式化，初始化为major分区
-        flash_tlv_format(tlv_sec);
+    tlv_sector_header_t header;
+    uint16_t version[TLV_SECTOR_MAX];
+    uint32_t valid = 0;
+    uint16_t newest = 0;
+    uint16_t index;
 
-    }else if(header_major.tag == TLV_SECTOR_TAG) {
-        tlv_sec->work_sector = tlv_sec->major_sector;
+    for(uint16_t i = 0; i < tlv_sec->sector_count; i++) {
+        flash_read(tlv_sec, sector_address(tlv_sec, i), TLV_SECTOR_HEADER_SIZE, (uint8_t *)&header);
+        if(header.tag != TLV_SECTOR_TAG) {
+            continue;
+        }
+        version[i] = header.version;
+        if((valid == 0) || ((int16_t)(header.version - version[newest]) > 0)) {
+            newest = i;
+        }
+        valid |= (1UL << i);
+    }
+    if(valid == 0) {
+        // 所有扇区tag都无效时，全部格式化，初始化为major分区
+        format_sector(tlv_sec);
+        return (tlv_sec->work_sector != INVALID_ADDRESS);
+    }
+    tlv_sec->work_index = newest;
+    tlv_sec->work_version = version[newest];
+    tlv_sec->work_sector = sector_address(tlv_sec, newest);
 
-    }else if(header_minor.tag == TLV_SECTOR_TAG) {
-        tlv_sec->work_sector = tlv_sec->minor_sector;
+    index = newest;
+    while(prev_index(tlv_sec, index) != newest) {
+        uint16_t prev = prev_index(tlv_sec, index);
+        if(!(valid & (1UL << prev)) || (version[prev] != (uint16_t)(version[index] - 1))) {
+            break;
+        }
+        index = prev;
     }
-    return (tlv_sec->work_sector != INVALID_ADDRESS);
+    tlv_sec->oldest_index = index;
+    return true;
 }
 
 /**
  * @brief 检查TLV数据块，只检查meta域，数据域发生错误不影响存储结构迭代
- * @note 检查条件：header!=0xFFFF and 0xAA55, 0xstatus!=0xFF, length!=0xFFFF 且在当前扇区范围内
+ * @note 检查条件：header为0xFFFF或0xAA55/0xAA56/0xAA57/0xAA58, 0xstatus!=0xFF, length!=0xFFFF 且在当前扇区范围内
  *       检查不通过时下一block地址为当前block地址+元数据大小(8字节)。(假定Nor Flash是顺序编程的)
  * @param current_addr 当前TLV结构的物理地址
  * @param end_addr 当前工作扇区的结束地址，可访问地址=(end_addr - 1)
@@ -296,7 +1467,9 @@ static bool check_tlv_block(uint32_t current_addr, uint32_t end_addr, tlv_block_
         // test pass
         return true;
     }
-    if(block->header != HEADER_VALID_TLV) {
+    if((block->header != HEADER_VALID_TLV) && (block->header != HEADER_COMMIT_TLV) &&
+       (block->header != HEADER_SUMMARY_TLV) && (block->header != HEADER_PART_TLV) &&
+       (block->header != HEADER_DELTA_TLV) && (block->header != HEADER_PACKED_TLV)) {
         // test pass
         return false;
     }
@@ -310,155 +1483,2179 @@ static bool check_tlv_block(uint32_t current_addr, uint32_t end_addr, tlv_block_
 }
 
 /**
- * @brief 按操作类型搜索数据块
- * @note TLV_BLOCK_APPEND: block.tag和block.length需要填写
- *       TLV_BLOCK_QUERY和TLV_BLOCK_DELETE: 只需要block.tag
- * @param sector 操作扇区
- * @param block 记录块
- * @param flag 搜索类型
+ * @brief 获取addr所在扇区的结束地址，可访问地址=(结束地址 - 1)
+ * @note 双扇区模式下minor扇区可以不与major扇区相邻，其余扇区从major_sector开始连续排列
  * */
-static tlv_err_t search_tlv(tlv_sector_t *sector, tlv_block_t *block, uint8_t flag) {
-    bool status = true;
-    tlv_block_t temp_block;
-    uint32_t start_addr, end_addr;
-    const uint8_t delete_flag = TLV_STATE_DELETE;
-    // 查找可用工作扇区
-    if(sector->work_sector == INVALID_ADDRESS) {
-        status = find_valid_sector(sector);
-        log("find valid sector:0x%08x", sector->work_sector);
-    }
-    if(!status) {
-        return TLV_NO_VALID_SECTOR;
+static uint32_t sector_end(const tlv_sector_t *sector, uint32_t addr) {
+    if((addr >= sector->minor_sector) && ((addr - sector->minor_sector) < sector->sector_size)) {
+        return (sector->minor_sector + sector->sector_size);
     }
-    start_addr = (sector->work_sector + TLV_SECTOR_HEADER_SIZE);
-    sector->dirty_blocks = 0;
-    log("use start addr:0x%08x", start_addr);
-
-    end_addr = (start_addr >> 12) + 1;
-    end_addr <<= 12;
+    return (sector->major_sector + ((addr - sector->major_sector) / sector->sector_size + 1) * sector->sector_size);
+}
 
-    while(start_addr < end_addr) {
-        if((start_addr + TLV_MEAT_SIZE) > end_addr) {
-            return TLV_META_SPACE_LOW;
-        }
-        log("flash read:0x%08x", start_addr);
-        flash_read(start_addr, TLV_MEAT_SIZE, (uint8_t *)&temp_block);
-        if(!check_tlv_block(start_addr, end_addr, &temp_block)) {
-            start_addr += TLV_MEAT_SIZE;
-            sector->dirty_blocks++;
-            log("bad block");
-            continue;
-        }
-        if(temp_block.header == HEADER_VALID_TLV) {
-            if(temp_block.status != TLV_STATE_VERIFY) {
-                sector->dirty_blocks++;
-            }
-            if(temp_block.tag == block->tag) {
-                if((flag == TLV_BLOCK_APPEND) && (temp_block.status != TLV_STATE_DELETE)) {
-                    // 追加新记录时，遇到相同TAG的旧记录缓存下来
-                    // 新纪录写入完成后，利用缓存地址将旧记录标记删除
-                    sector->mark_address = start_addr;
-                    log("mark:0x%04x,0x%08x", block->tag, sector->mark_address);
-                }else if((flag == TLV_BLOCK_QUERY) && (temp_block.status == TLV_STATE_VERIFY)) {
-                    // 查询时，找到相同TAG且状态有效
-                    memcpy(block, &temp_block, TLV_MEAT_SIZE);
-                    block->entity = (start_addr + TLV_MEAT_SIZE);
-                    return TLV_RESULT_OK;
-                }else if((flag == TLV_BLOCK_DELETE) && (temp_block.status != TLV_STATE_DELETE)) {
-                    flash_write((start_addr + 2), 1, &delete_flag);
-                    sector->dirty_blocks++;
-                    return TLV_RESULT_OK;
-                }
-            }
-            // 下一TLV块
-            start_addr += (TLV_MEAT_SIZE + temp_block.length);
-            log("next start_addr:0x%08x", start_addr);
-
-        }else if(temp_block.header == HEADER_EMPTY_TLV) {
-            if(flag == TLV_BLOCK_APPEND) {
-                if((end_addr - start_addr) >= (TLV_MEAT_SIZE + block->length)) {
-                    block->entity = start_addr;
-                    return TLV_RESULT_OK;
-                }else {
-                    return TLV_DATA_SPACE_LOW;
-                }
-            }
-            // flag is 'TLV_BLOCK_QUERY' or 'TLV_BLOCK_DELETE'
-            break;
-        }
-    }
-    return TLV_RESULT_NOT_FOUND;
+/**
+ * @brief 更新记录状态(1->0)
+ * @param address 记录Meta域的起始地址
+ * */
+static void set_status(tlv_sector_t *sector, uint32_t address, uint8_t status) {
+    flash_write(sector, (address + 2), 1, &status);
 }
 
 /**
- * @brief tlv扇区整理，方式为标记+整理，完成后有效扇区无碎片产生
- * @return GC完成后可用空间(bytes)
+ * @brief 标记记录删除并更新空间统计
+ * @param address 记录Meta域的起始地址
+ * @param length 记录数据域长度
  * */
-static uint32_t flash_tlv_gc(tlv_sector_t *sector) {
-    uint32_t swap_sector;
-    uint32_t read_addr, write_addr, end_addr;
-    tlv_sector_header_t sector_header;
+static void mark_delete(tlv_sector_t *sector, uint32_t address, uint16_t length) {
+    set_status(sector, address, TLV_STATE_DELETE);
+    sector->live_bytes -= (TLV_MEAT_SIZE + length);
+    sector->dirty_bytes += (TLV_MEAT_SIZE + length);
+    sector->dirty_blocks++;
+}
 
+/**
+ * @brief 标记tag原来的值删除，值带有增量链时删除整条链
+ * @param address 索引或mark_address中的记录地址(链头)
+ * @param length 该记录的数据域长度
+ * */
+static void drop_value(tlv_sector_t *sector, uint32_t address, uint16_t length) {
+#if FLASH_TLV_USE_DELTA
+    tlv_chain_t chain;
+    if(load_chain(sector, address, &chain)) {
+        drop_chain(sector, &chain);
+        return;
+    }
+#endif
+    mark_delete(sector, address, length);
+}
+
+/**
+ * @brief 扫描时统计一条有效记录
+ * @note 同一tag出现多条有效记录时(追加新记录后、标记旧记录前掉电)，以最后一条为准并补标记旧记录删除
+ * */
+static void scan_live(tlv_sector_t *sector, uint32_t address, const tlv_block_t *block) {
+#if FLASH_TLV_USE_INDEX
+    const index_item_t *item = index_find(&sector->index, block->tag);
+    if(item != NULL) {
+        drop_value(sector, item->address, item->length);
+    }
+    index_update(&sector->index, block->tag, address, block->length);
+#else
+    (void)address;
+#endif
+    sector->live_bytes += (TLV_MEAT_SIZE + block->length);
+}
+
+/**
+ * @brief 恢复已提交但未确认完成的批量写入
+ * @note 扫描到提交标记前，批内TLV_STATE_WRITE状态的记录已被统计为无效，这里改为有效
+ * @param base 提交标记所在扇区的地址，整批记录与提交标记在同一扇区
+ * @param commit_addr 状态为TLV_STATE_VERIFY的提交标记地址
+ * */
+static void recover_batch(tlv_sector_t *sector, uint32_t base, uint32_t commit_addr) {
     tlv_block_t temp_block;
-    uint8_t buffer[32];
-    uint32_t trunk;
+    uint32_t address;
+    uint32_t end_addr = sector_end(sector, commit_addr);
 
-    // 只会在flash_tlv_append时发生GC操作
-    // 经历过一次全扇区扫描，可用得到准确的dirty_blocks数量
-    if(sector->dirty_blocks == 0) {
-        return 0;
+    flash_read(sector, (commit_addr + TLV_MEAT_SIZE), sizeof(uint32_t), (uint8_t *)&address);
+    if((address < (base + TLV_SECTOR_HEADER_SIZE)) || (address > commit_addr)) {
+        return;
+    }
+    while(address < commit_addr) {
+        read_meta(sector, address, &temp_block);
+        if(!check_tlv_block(address, end_addr, &temp_block) || (temp_block.header != HEADER_VALID_TLV)) {
+            break;
+        }
+        if(temp_block.status == TLV_STATE_WRITE) {
+            set_status(sector, address, TLV_STATE_VERIFY);
+            sector->dirty_blocks--;
+            sector->dirty_bytes -= (TLV_MEAT_SIZE + temp_block.length);
+            scan_live(sector, address, &temp_block);
+        }
+        address += (TLV_MEAT_SIZE + temp_block.length);
     }
-    swap_sector = (sector->work_sector == sector->major_sector) ?
-                  sector->minor_sector : sector->major_sector;
+    log("batch recovered: 0x%08x", commit_addr);
+    set_status(sector, commit_addr, TLV_STATE_DELETE);
+}
 
-    read_addr = (sector->work_sector + TLV_SECTOR_HEADER_SIZE);
-    write_addr = (swap_sector + TLV_SECTOR_HEADER_SIZE);
+/**
+ * @brief 扫描一个扇区内的记录，累计有效/无效字节数，启用索引时同时更新索引
+ * @note 已提交未完成的批量写入在扫描过程中补完，接不上链头的增量记录(删除增量链时掉电残留)补标记删除
+ * @param base 扇区地址
+ * @param start 开始扫描的记录地址，整个扇区为base + TLV_SECTOR_HEADER_SIZE
+ * @return 扇区内第一个空闲记录的地址
+ * */
+static uint32_t scan_records(tlv_sector_t *sector, uint32_t base, uint32_t start) {
+    tlv_block_t temp_block;
+    uint32_t start_addr, end_addr;
+#if FLASH_TLV_USE_INDEX
+    const index_item_t *item;
+#endif
+    start_addr = start;
+    end_addr = sector_end(sector, start_addr);
 
-    end_addr = (read_addr >> 12) + 1;
-    end_addr <<= 12;
+    while((start_addr + TLV_MEAT_SIZE) <= end_addr) {
+        read_meta(sector, start_addr, &temp_block);
+        if(!check_tlv_block(start_addr, end_addr, &temp_block)) {
+            start_addr += TLV_MEAT_SIZE;
+            sector->dirty_blocks++;
+            sector->dirty_bytes += TLV_MEAT_SIZE;
+            continue;
+        }
+        if(temp_block.header == HEADER_EMPTY_TLV) {
+            break;
+        }
+        if(is_value(temp_block.header) && (temp_block.status == TLV_STATE_VERIFY)) {
+            scan_live(sector, start_addr, &temp_block);
+        }
+#if FLASH_TLV_USE_STREAM
+        // 已确认的分段按有效记录统计，不进入索引，不再属于任何值头的分段在整理时回收
+        else if((temp_block.header == HEADER_PART_TLV) && (temp_block.status == TLV_STATE_VERIFY)) {
+            sector->live_bytes += (TLV_MEAT_SIZE + temp_block.length);
+        }
+#endif
+#if FLASH_TLV_USE_DELTA
+        else if((temp_block.header == HEADER_DELTA_TLV) && (temp_block.status == TLV_STATE_VERIFY) &&
+                scan_delta(sector, start_addr, &temp_block)) {
+            sector->live_bytes += (TLV_MEAT_SIZE + temp_block.length);
+        }
+#endif
+        else {
+            if(temp_block.header == HEADER_COMMIT_TLV) {
+                if(temp_block.status == TLV_STATE_VERIFY) {
+                    recover_batch(sector, base, start_addr);
+                }
+            }
+#if FLASH_TLV_USE_INDEX
+            // 标记删除的记录之前不可能还有同tag的有效记录
+            else if(is_value(temp_block.header) && (temp_block.status == TLV_STATE_DELETE) &&
+                    ((item = index_find(&sector->index, temp_block.tag)) != NULL)) {
+                drop_value(sector, item->address, item->length);
+                index_remove(&sector->index, temp_block.tag);
+            }
+#endif
+            sector->dirty_blocks++;
+            sector->dirty_bytes += (TLV_MEAT_SIZE + temp_block.length);
+        }
+        start_addr += (TLV_MEAT_SIZE + temp_block.length);
+    }
+    return start_addr;
+}
 
-    flash_erase(swap_sector, sector->sector_size);
+/**
+ * @brief 从最旧扇区到工作扇区完整扫描一次，得到写入地址、有效/无效字节数，启用索引时同时建立索引
+ * @note 非工作扇区尾部未使用的空间计为无效字节，在整理该扇区时回收；启用挂载摘要时先尝试从摘要恢复
+ * @param sector 已确定work_sector的操作扇区
+ * */
+static void scan_sector(tlv_sector_t *sector) {
+    uint16_t index = sector->oldest_index;
+    uint32_t base, end_addr;
+#if FLASH_TLV_USE_INDEX
+    index_reset(&sector->index);
+#endif
+    sector->dirty_blocks = 0;
+    sector->live_bytes = 0;
+    sector->dirty_bytes = 0;
+#if FLASH_TLV_USE_DELTA
+    sector->delta_reserve = 0;
+#endif
+#if FLASH_TLV_USE_SUMMARY
+    sector->summary_address = INVALID_ADDRESS;
+    if(load_summary(sector)) {
+        log("summary loaded, write addr:0x%08x", sector->write_address);
+        return;
+    }
+#endif
 
-    while(read_addr < end_addr) {
-        if((read_addr + TLV_MEAT_SIZE) > end_addr) {
+    while(1) {
+        base = sector_address(sector, index);
+        end_addr = scan_records(sector, base, (base + TLV_SECTOR_HEADER_SIZE));
+        if(index == sector->work_index) {
+            sector->write_address = end_addr;
             break;
         }
-        flash_read(read_addr, TLV_MEAT_SIZE, (uint8_t *)&temp_block);
-        if(!check_tlv_block(read_addr, end_addr, &temp_block)) {
-            read_addr += TLV_MEAT_SIZE;
+        sector->dirty_bytes += (sector_end(sector, base) - end_addr);
+        index = next_index(sector, index);
+    }
+    log("scan done, write addr:0x%08x, live:%d, dirty:%d",
+        sector->write_address, sector->live_bytes, sector->dirty_bytes);
+}
+
+#if FLASH_TLV_USE_INDEX
+/**
+ * @brief 通过索引完成查询或删除操作
+ * @param err 索引能确定结果时的返回值
+ * @return true:结果已由索引确定，false:需要扫描扇区(索引不完整且未命中)
+ * */
+static bool search_index(tlv_sector_t *sector, tlv_block_t *block, uint8_t flag, tlv_err_t *err) {
+    const index_item_t *item = index_find(&sector->index, block->tag);
+
+    if(item == NULL) {
+        *err = TLV_RESULT_NOT_FOUND;
+        return (sector->index.complete != 0);
+    }
+    if(flag == TLV_BLOCK_QUERY) {
+        read_meta(sector, item->address, block);
+        block->entity = (item->address + TLV_MEAT_SIZE);
+    }else {
+        drop_value(sector, item->address, item->length);
+        index_remove(&sector->index, block->tag);
+    }
+    *err = TLV_RESULT_OK;
+    return true;
+}
+#endif
+
+/**
+ * @brief 确保工作扇区已确定，首次访问或写入失败后扫描所有扇区得到写入地址
+ * @return true:工作扇区有效
+ * */
+static bool mount_sector(tlv_sector_t *sector) {
+    if(sector->work_sector == INVALID_ADDRESS) {
+        if(!find_valid_sector(sector)) {
+            return false;
+        }
+        log("find valid sector:0x%08x", sector->work_sector);
+        sector->write_address = INVALID_ADDRESS;
+    }
+    if(sector->write_address == INVALID_ADDRESS) {
+        sector->gc_address = INVALID_ADDRESS;
+        scan_sector(sector);
+        if(free_sectors(sector) == 0) {
+            // 没有空闲扇区说明整理最旧扇区时掉电，重新开始整理，由后续追加或flash_tlv_gc_step完成
+            log("resume gc");
+            gc_begin(sector);
+#if FLASH_TLV_USE_STREAM
+            drop_copied(sector);
+#endif
+        }
+    }
+#if FLASH_TLV_USE_COLD
+    if(sector->cold != NULL) {
+        return mount_sector(sector->cold);
+    }
+#endif
+    return true;
+}
+
+/**
+ * @brief 工作扇区和写入地址都已确定(包括冷区)
+ * */
+static inline bool is_mounted(const tlv_sector_t *sector) {
+#if FLASH_TLV_USE_COLD
+    if((sector->cold != NULL) && !is_mounted(sector->cold)) {
+        return false;
+    }
+#endif
+    return ((sector->work_sector != INVALID_ADDRESS) && (sector->write_address != INVALID_ADDRESS));
+}
+
+/**
+ * @brief 读操作开始，共享持有锁；尚未挂载时先独占持有锁完成挂载扫描，读操作本身不修改存储状态
+ * */
+static void read_begin(tlv_sector_t *sector) {
+    lock_read(sector);
+    if(!is_mounted(sector)) {
+        unlock_read(sector);
+        lock_write(sector);
+        mount_sector(sector);
+        unlock_write(sector);
+        lock_read(sector);
+    }
+}
+
+/**
+ * @return 写入地址到工作扇区结束的可用空间(bytes)
+ * */
+static uint32_t free_space(tlv_sector_t *sector) {
+    return (sector_end(sector, sector->work_sector + TLV_SECTOR_HEADER_SIZE) - sector->write_address);
+}
+
+/**
+ * @brief 追加记录可用的空间
+ * @note 整理进行中且没有空闲扇区时，为最旧扇区中尚未处理的部分预留空间，保证整理能够完成；
+ *       只剩一个空闲扇区时还要预留开始整理时折叠全部增量链的空间
+ * @return 可分配给新记录的字节数
+ * */
+static uint32_t append_space(tlv_sector_t *sector) {
+    uint32_t space = free_space(sector);
+    uint32_t pending = 0;
+
+#if FLASH_TLV_USE_DELTA
+    if(free_sectors(sector) <= 1) {
+        pending = sector->delta_reserve;
+    }
+#endif
+    if((sector->gc_address != INVALID_ADDRESS) && (free_sectors(sector) == 0)) {
+        pending += (sector_end(sector, sector->gc_address) - sector->gc_address);
+    }
+    return (space > pending) ? (space - pending) : 0;
+}
+
+/**
+ * @brief 启用下一个空闲扇区作为工作扇区，调用前需保证存在空闲扇区
+ * @note 旧工作扇区尾部剩余空间计为无效字节
+ * */
+static void open_sector(tlv_sector_t *sector) {
+    tlv_sector_header_t sector_header;
+    uint16_t index = next_index(sector, sector->work_index);
+    uint32_t address = sector_address(sector, index);
+
+    sector->dirty_bytes += free_space(sector);
+    // 空闲扇区在启用时才擦除，整理完成的扇区只需要作废扇区头
+    erase_sector(sector, address);
+    sector_header.tag = TLV_SECTOR_TAG;
+    sector_header.version = (uint16_t)(sector->work_version + 1);
+    flash_write(sector, address, TLV_SECTOR_HEADER_SIZE, (uint8_t *)&sector_header);
+
+    sector->work_index = index;
+    sector->work_version = sector_header.version;
+    sector->work_sector = address;
+    sector->write_address = (address + TLV_SECTOR_HEADER_SIZE);
+    log("open sector:0x%08x, version:%d", address, sector_header.version);
+#if FLASH_TLV_USE_SUMMARY
+    sector->summary_address = INVALID_ADDRESS;
+    // 整理过程中启用的扇区在整理完成时写入摘要
+    if(sector->gc_address == INVALID_ADDRESS) {
+        write_summary(sector);
+    }
+#endif
+}
+
+/**
+ * @brief 保证工作扇区有need字节的连续可用空间
+ * @note 还有多个空闲扇区时直接启用下一个扇区，只剩一个空闲扇区时整理最旧的扇区，
+ *       有进行中的整理时先完成它，无效数据不在最旧扇区时可能需要连续整理多个扇区
+ * @return true:空间已满足
+ * */
+static bool make_space(tlv_sector_t *sector, uint32_t need) {
+    uint16_t rounds = 0;
+
+    if(need > (sector->sector_size - TLV_SECTOR_HEADER_SIZE)) {
+        return false;
+    }
+    while(append_space(sector) < need) {
+        if(free_sectors(sector) > 1) {
+            open_sector(sector);
             continue;
         }
-        if(temp_block.status == TLV_STATE_VERIFY) {
-            // 移动有效数据到第二分区
-            flash_write(write_addr, TLV_MEAT_SIZE, (uint8_t *)&temp_block);
-            write_addr += TLV_MEAT_SIZE;
-            read_addr += TLV_MEAT_SIZE;
-            do{
-                trunk = (temp_block.length > 32) ? 32 : temp_block.length;
+        // 没有可回收的空间
+        if(((sector->dirty_bytes == 0) && (sector->gc_address == INVALID_ADDRESS)) ||
+           (rounds > sector->sector_count)) {
+            return false;
+        }
+        flash_tlv_gc(sector);
+        rounds++;
+    }
+    return true;
+}
 
-                flash_read(read_addr, trunk, buffer);
-                flash_write(write_addr, trunk, buffer);
+/**
+ * @brief 在写入地址处为新记录分配空间
+ * @param block 需要填写block.length，成功时block.entity为记录Meta域地址
+ * */
+static tlv_err_t reserve_space(tlv_sector_t *sector, tlv_block_t *block) {
+    if(append_space(sector) < ((uint32_t)TLV_MEAT_SIZE + block->length)) {
+        return TLV_DATA_SPACE_LOW;
+    }
+    block->entity = sector->write_address;
+    return TLV_RESULT_OK;
+}
+
+/**
+ * @brief 按操作类型搜索数据块
+ * @note TLV_BLOCK_APPEND: block.tag和block.length需要填写，旧记录地址存入mark_address
+ *       TLV_BLOCK_MARK: 只查找旧记录地址存入mark_address，不分配空间
+ *       TLV_BLOCK_QUERY和TLV_BLOCK_DELETE: 只需要block.tag
+ *       只有索引未启用或索引不完整且未命中时才需要扫描，从最旧扇区扫描到工作扇区的写入地址为止
+ * @param sector 操作扇区
+ * @param block 记录块
+ * @param flag 搜索类型
+ * */
+static tlv_err_t search_tlv(tlv_sector_t *sector, tlv_block_t *block, uint8_t flag) {
+    bool match_tag = true;
+    tlv_block_t temp_block;
+    uint32_t start_addr, end_addr;
+    uint16_t index;
+    // 查找可用工作扇区
+    if(!mount_sector(sector)) {
+        return TLV_NO_VALID_SECTOR;
+    }
+    bool append = ((flag == TLV_BLOCK_APPEND) || (flag == TLV_BLOCK_MARK));
+    if(append) {
+        sector->mark_address = 0;
+    }
+#if FLASH_TLV_USE_INDEX
+    tlv_err_t err;
+    if(append) {
+        const index_item_t *item = index_find(&sector->index, block->tag);
+        if(item != NULL) {
+            sector->mark_address = item->address;
+            sector->mark_length = item->length;
+        }
+        match_tag = ((item == NULL) && !sector->index.complete);
+    }else if(search_index(sector, block, flag, &err)) {
+        return err;
+    }
+#endif
+    if(append && !match_tag) {
+        return (flag == TLV_BLOCK_MARK) ? TLV_RESULT_OK : reserve_space(sector, block);
+    }
+    index = sector->oldest_index;
+    start_addr = (sector_address(sector, index) + TLV_SECTOR_HEADER_SIZE);
+    end_addr = sector_end(sector, start_addr);
+    log("use start addr:0x%08x", start_addr);
+
+    while(1) {
+        if((start_addr >= sector->write_address) && (index == sector->work_index)) {
+            break;
+        }
+        if((start_addr + TLV_MEAT_SIZE) > end_addr) {
+            goto LAB_NEXT_SECTOR;
+        }
+        log("flash read:0x%08x", start_addr);
+        read_meta(sector, start_addr, &temp_block);
+        if(!check_tlv_block(start_addr, end_addr, &temp_block)) {
+            start_addr += TLV_MEAT_SIZE;
+            log("bad block");
+            continue;
+        }
+        if(temp_block.header == HEADER_EMPTY_TLV) {
+            goto LAB_NEXT_SECTOR;
+        }
+        if(is_value(temp_block.header) && (temp_block.tag == block->tag) &&
+           (temp_block.status == TLV_STATE_VERIFY)) {
+            if(append) {
+                // 追加新记录时，遇到相同TAG的旧记录缓存下来
+                // 新纪录写入完成后，利用缓存地址将旧记录标记删除
+                sector->mark_address = start_addr;
+                sector->mark_length = temp_block.length;
+                log("mark:0x%04x,0x%08x", block->tag, sector->mark_address);
+            }else if(flag == TLV_BLOCK_QUERY) {
+                // 查询时，找到相同TAG且状态有效
+                memcpy(block, &temp_block, TLV_MEAT_SIZE);
+                block->entity = (start_addr + TLV_MEAT_SIZE);
+                return TLV_RESULT_OK;
+            }else {
+                mark_delete(sector, start_addr, temp_block.length);
+                return TLV_RESULT_OK;
+            }
+        }
+        // 下一TLV块
+        start_addr += (TLV_MEAT_SIZE + temp_block.length);
+        log("next start_addr:0x%08x", start_addr);
+        continue;
+
+        LAB_NEXT_SECTOR:
+        if(index == sector->work_index) {
+            break;
+        }
+        index = next_index(sector, index);
+        start_addr = (sector_address(sector, index) + TLV_SECTOR_HEADER_SIZE);
+        end_addr = sector_end(sector, start_addr);
+    }
+    if(append) {
+        return (flag == TLV_BLOCK_MARK) ? TLV_RESULT_OK : reserve_space(sector, block);
+    }
+    return TLV_RESULT_NOT_FOUND;
+}
+
+/**
+ * @brief 开始暂存写入，address为第一个字节的写入地址
+ * */
+static void page_begin(page_writer_t *writer, uint32_t address) {
+    writer->address = address;
+    writer->length = 0;
+}
+
+/**
+ * @brief 写出暂存的数据(一次页编程)
+ * */
+static void page_flush(tlv_sector_t *sector, page_writer_t *writer) {
+    if(writer->length == 0) {
+        return;
+    }
+    flash_write(sector, writer->address, writer->length, writer->page);
+    writer->address += writer->length;
+    writer->length = 0;
+}
 
-                read_addr += trunk;
-                write_addr += trunk;
-                temp_block.length -= trunk;
-            }while(temp_block.length);
+/**
+ * @brief 暂存写入数据，写满一页时编程该页
+ * @note 暂存区为空且数据覆盖到页尾时直接编程，不经过暂存区
+ * */
+static void page_put(tlv_sector_t *sector, page_writer_t *writer, const uint8_t *data, uint32_t length) {
+    uint32_t room, trunk;
+
+    while(length) {
+        room = TLV_PAGE_SIZE - ((writer->address + writer->length) % TLV_PAGE_SIZE);
+        trunk = (length > room) ? room : length;
+        if((writer->length == 0) && (trunk == room)) {
+            flash_write(sector, writer->address, trunk, data);
+            writer->address += trunk;
         }else {
-            read_addr += (TLV_MEAT_SIZE + temp_block.length);
+            memcpy((writer->page + writer->length), data, trunk);
+            writer->length += trunk;
+            if(trunk == room) {
+                page_flush(sector, writer);
+            }
         }
+        data += trunk;
+        length -= trunk;
     }
+}
 
-    flash_read(sector->work_sector, TLV_SECTOR_HEADER_SIZE, (uint8_t *)&sector_header);
-    if(sector_header.version == TLV_VERSION_MAX) {
-        sector_header.version = TLV_VERSION_MIN;
-    }else {
-        sector_header.version++;
+/**
+ * @brief 从Flash的source地址读取length字节暂存写入，按目标页边界分段读取
+ * */
+static void page_copy(tlv_sector_t *sector, page_writer_t *writer, uint32_t source, uint32_t length) {
+    uint32_t room, trunk;
+
+    while(length) {
+        room = TLV_PAGE_SIZE - ((writer->address + writer->length) % TLV_PAGE_SIZE);
+        trunk = (length > room) ? room : length;
+        flash_read(sector, source, trunk, (writer->page + writer->length));
+        writer->length += trunk;
+        if(trunk == room) {
+            page_flush(sector, writer);
+        }
+        source += trunk;
+        length -= trunk;
+    }
+}
+
+/**
+ * @brief 填写记录Meta域: 记录头、TLV_STATE_WRITE状态和校验值
+ * @param block 需要填写tag和length
+ * */
+static void make_meta(tlv_block_t *block, uint16_t header, const uint8_t *data) {
+    record_crc_t crc = record_crc_update(record_crc_begin(block), data, block->length);
+
+    block->header = header;
+    block->status = TLV_STATE_WRITE;
+#if FLASH_TLV_USE_CRC32
+    block->crc8 = 0xFF;
+#endif
+    record_crc_stored(block) = crc;
+}
+
+/**
+ * @brief 在block->entity处暂存一条TLV_STATE_WRITE状态的记录，Meta域和数据域合并编程，写入地址后移
+ * @note 记录状态保持TLV_STATE_WRITE，合并编程中途掉电时记录只会被视为无效记录
+ * @param block 需要填写tag、length和entity(Meta域地址)
+ * @param header 记录头，HEADER_VALID_TLV或HEADER_COMMIT_TLV
+ * */
+static void stage_record(tlv_sector_t *sector, page_writer_t *writer, tlv_block_t *block, uint16_t header,
+                         const uint8_t *data) {
+    make_meta(block, header, data);
+    page_put(sector, writer, (const uint8_t *)block, TLV_MEAT_SIZE);
+    page_put(sector, writer, data, block->length);
+    sector->write_address = (block->entity + TLV_MEAT_SIZE + block->length);
+}
+
+/**
+ * @brief 按sector->verify_mode回读校验stage_record写入的记录
+ * @note Meta域和数据域连续存放，按FLASH_TLV_BUFFER_SIZE分段一起读取；
+ *       data为NULL(数据域不在连续内存中)时TLV_VERIFY_FULL按TLV_VERIFY_CRC校验
+ * @param block stage_record填写过的记录
+ * @return true:校验通过
+ * */
+static bool verify_record(tlv_sector_t *sector, const tlv_block_t *block, const uint8_t *data) {
+    record_crc_t crc;
+    uint8_t buffer[FLASH_TLV_BUFFER_SIZE];
+    uint32_t count, meta, offset = 0;
+    uint32_t total = (TLV_MEAT_SIZE + block->length);
+    uint8_t mode = ((data == NULL) && (sector->verify_mode == TLV_VERIFY_FULL)) ? TLV_VERIFY_CRC : sector->verify_mode;
+
+    if(mode == TLV_VERIFY_NONE) {
+        return true;
+    }
+    crc = record_crc_begin(block);
+    while(offset < total) {
+        count = ((total - offset) > FLASH_TLV_BUFFER_SIZE) ? FLASH_TLV_BUFFER_SIZE : (total - offset);
+        flash_read(sector, (block->entity + offset), count, buffer);
+        // 本段中属于Meta域的字节数
+        meta = (offset < TLV_MEAT_SIZE) ? (TLV_MEAT_SIZE - offset) : 0;
+        meta = (meta > count) ? count : meta;
+        if((meta != 0) && (memcmp(buffer, ((const uint8_t *)block + offset), meta) != 0)) {
+            break;
+        }
+        if(mode == TLV_VERIFY_CRC) {
+            crc = record_crc_update(crc, (buffer + meta), (count - meta));
+        }else if(memcmp((buffer + meta), (data + offset + meta - TLV_MEAT_SIZE), (count - meta)) != 0) {
+            break;
+        }
+        offset += count;
+    }
+    if((offset == total) && ((mode != TLV_VERIFY_CRC) || (crc == record_crc_stored(block)))) {
+        return true;
     }
-    flash_write(swap_sector, TLV_SECTOR_HEADER_SIZE, (uint8_t *)&sector_header);
-    sector->work_sector = swap_sector;
+    // 写入位置的内容已不可预测，下次追加前重新扫描扇区
+    sector->write_address = INVALID_ADDRESS;
+    return false;
+}
+
+/**
+ * @brief 在block->entity处写入一条TLV_STATE_WRITE状态的记录并回读校验，写入地址后移
+ * @param block 需要填写tag、length和entity(Meta域地址)
+ * @param header 记录头，HEADER_VALID_TLV或HEADER_COMMIT_TLV
+ * @return true:校验通过
+ * */
+static bool write_record(tlv_sector_t *sector, tlv_block_t *block, uint16_t header, const uint8_t *data) {
+    page_writer_t writer;
+
+    page_begin(&writer, block->entity);
+    stage_record(sector, &writer, block, header, data);
+    page_flush(sector, &writer);
+    return verify_record(sector, block, data);
+}
 
-    end_addr = (swap_sector >> 12) + 1;
-    end_addr <<= 12;
-    log("gc done: %d", (end_addr - write_addr));
-    return (end_addr - write_addr);
+/**
+ * @brief 确认write_record写入的记录(0xFE变成0xFC)，标记mark_address处的旧记录删除，更新索引和缓存
+ * @param block write_record写入的记录，完成后entity更新为数据域地址
+ * @param data 记录的数据域，为NULL(数据不在连续内存中)时不缓存数据域
+ * */
+static void commit_record(tlv_sector_t *sector, tlv_block_t *block, const uint8_t *data) {
+    // 更新确认标记(1->0)，0xFE变成0xFC
+    set_status(sector, block->entity, TLV_STATE_VERIFY);
+    block->status = TLV_STATE_VERIFY;
+#if FLASH_TLV_USE_INDEX
+    index_update(&sector->index, block->tag, block->entity, block->length);
+#endif
+    // entity域更新到实际数据域起始地址
+    block->entity += TLV_MEAT_SIZE;
+    sector->live_bytes += (TLV_MEAT_SIZE + block->length);
+    // 删除上一条相同tag的记录(如果存在)
+    if(sector->mark_address != 0) {
+        drop_value(sector, sector->mark_address, sector->mark_length);
+        log("mark delete:0x%04x", block->tag);
+        sector->mark_address = 0;
+    }
+    // 更新缓存
+#if FLASH_TLV_USE_CACHE
+    log("append: add to cache");
+    set_cache(&sector->cache, block->tag, block);
+#endif
+#if FLASH_TLV_USE_VALUE_CACHE
+    if(data != NULL) {
+        set_value(&sector->cache, block, data);
+    }
+#else
+    (void)data;
+#endif
+#if FLASH_TLV_USE_COLD
+    // 记录被更新，热度增加，冷区中的旧记录作废
+    index_touch(&sector->index, block->tag);
+    drop_cold(sector, block->tag);
+#endif
 }
+
+/**
+ * @brief 把一条有效记录复制到工作扇区，先以TLV_STATE_WRITE状态写入，数据复制完成后再确认
+ * @note 工作扇区空间不足时启用下一个空闲扇区(整理过程允许使用最后一个空闲扇区)；分段记录不更新索引
+ * @param address 源记录Meta域地址
+ * @param block 源记录Meta域
+ * @return true:复制完成
+ * */
+static bool copy_record(tlv_sector_t *sector, uint32_t address, tlv_block_t *block) {
+    page_writer_t writer;
+    uint32_t write_addr;
+    uint32_t length = block->length;
+
+    if(free_space(sector) < (TLV_MEAT_SIZE + length)) {
+        if(free_sectors(sector) == 0) {
+            return false;
+        }
+        open_sector(sector);
+    }
+    write_addr = sector->write_address;
+
+    block->status = TLV_STATE_WRITE;
+    page_begin(&writer, write_addr);
+    page_put(sector, &writer, (const uint8_t *)block, TLV_MEAT_SIZE);
+    page_copy(sector, &writer, (address + TLV_MEAT_SIZE), length);
+    page_flush(sector, &writer);
+    set_status(sector, write_addr, TLV_STATE_VERIFY);
+    block->status = TLV_STATE_VERIFY;
+#if FLASH_TLV_USE_INDEX
+    if(is_value(block->header)) {
+        index_update(&sector->index, block->tag, write_addr, block->length);
+    }
+#endif
+    sector->write_address = (write_addr + TLV_MEAT_SIZE + block->length);
+    sector->live_bytes += (TLV_MEAT_SIZE + block->length);
+    return true;
+}
+
+/**
+ * @brief 开始整理最旧的扇区，整理进度从扇区第一条记录开始
+ * @note 最旧扇区就是工作扇区时(双扇区模式)，先启用空闲扇区再整理；
+ *       先折叠全部增量链，整理过程中不再有增量链，复制的数据量不超过最旧扇区
+ * */
+static void gc_begin(tlv_sector_t *sector) {
+#if FLASH_TLV_USE_DELTA
+    fold_all(sector);
+#endif
+    sector->gc_address = (sector_address(sector, sector->oldest_index) + TLV_SECTOR_HEADER_SIZE);
+    sector->gc_blocks = 0;
+    if(sector->oldest_index == sector->work_index) {
+        open_sector(sector);
+    }
+    log("gc begin: 0x%08x", sector->gc_address);
+}
+
+/**
+ * @brief 从gc_address继续整理最旧扇区：有效记录复制到工作扇区(冷记录移到冷区)后标记原记录删除，
+ *        带有增量链的记录与增量记录折叠为一条完整记录，仍属于值头或进行中写入的分段同样复制，其余分段直接回收；
+ *        扇区处理完成后作废该扇区，所有tag热度减半
+ * @note 整理过程中掉电，挂载时发现没有空闲扇区，会重新整理最旧的扇区，已标记删除的记录不再复制
+ * @param records 本次最多处理的记录数
+ * @return true:正常完成本次整理，false:工作扇区空间不足，无法复制记录
+ * */
+static bool gc_run(tlv_sector_t *sector, uint16_t records) {
+    uint32_t victim, read_addr, end_addr;
+    const uint16_t retired = 0x0000;
+    tlv_block_t temp_block;
+#if FLASH_TLV_USE_DELTA
+    const index_item_t *item;
+    tlv_chain_t chain;
+#endif
+
+    victim = sector_address(sector, sector->oldest_index);
+    read_addr = sector->gc_address;
+    end_addr = sector_end(sector, read_addr);
+
+    while((read_addr + TLV_MEAT_SIZE) <= end_addr) {
+        if(records == 0) {
+            sector->gc_address = read_addr;
+            return true;
+        }
+        records--;
+        read_meta(sector, read_addr, &temp_block);
+        if(!check_tlv_block(read_addr, end_addr, &temp_block)) {
+            read_addr += TLV_MEAT_SIZE;
+            sector->gc_blocks++;
+            continue;
+        }
+        if(temp_block.header == HEADER_EMPTY_TLV) {
+            break;
+        }
+        if(is_value(temp_block.header) && (temp_block.status == TLV_STATE_VERIFY)) {
+#if FLASH_TLV_USE_DELTA
+            // 开始整理时没能折叠的增量链，在复制它的完整记录时折叠，整条链同时标记删除
+            item = index_find(&sector->index, temp_block.tag);
+            if((item != NULL) && (item->address != read_addr) && load_chain(sector, item->address, &chain) &&
+               (chain.links[0].address == read_addr)) {
+                if(!fold_chain(sector, &chain, temp_block.tag)) {
+                    sector->gc_address = read_addr;
+                    return false;
+                }
+                sector->gc_blocks++;
+                read_addr += (TLV_MEAT_SIZE + temp_block.length);
+                continue;
+            }
+#endif
+#if FLASH_TLV_USE_COLD
+            // 冷记录移到冷区，冷区空间不足时仍复制到工作扇区
+            if(move_cold(sector, read_addr, &temp_block)) {
+                mark_delete(sector, read_addr, temp_block.length);
+                sector->gc_blocks++;
+                read_addr += (TLV_MEAT_SIZE + temp_block.length);
+                continue;
+            }
+#endif
+            // 移动有效数据到工作扇区
+            if(!copy_record(sector, read_addr, &temp_block)) {
+                sector->gc_address = read_addr;
+                return false;
+            }
+            mark_delete(sector, read_addr, temp_block.length);
+        }
+#if FLASH_TLV_USE_STREAM
+        else if((temp_block.header == HEADER_PART_TLV) && (temp_block.status == TLV_STATE_VERIFY)) {
+            // 摘要不记录分段的位置，分段移动后摘要作废
+            invalidate_summary(sector, read_addr);
+            if(part_live(sector, read_addr, &temp_block) && !copy_record(sector, read_addr, &temp_block)) {
+                sector->gc_address = read_addr;
+                return false;
+            }
+            mark_delete(sector, read_addr, temp_block.length);
+        }
+#endif
+#if FLASH_TLV_USE_DELTA
+        else if((temp_block.header == HEADER_DELTA_TLV) && (temp_block.status == TLV_STATE_VERIFY)) {
+            // 增量记录在链的完整记录被折叠时已标记删除，这里只剩接不上链的残留
+            mark_delete(sector, read_addr, temp_block.length);
+        }
+#endif
+        sector->gc_blocks++;
+        read_addr += (TLV_MEAT_SIZE + temp_block.length);
+    }
+    // 作废扇区头，扇区在下次启用时擦除，扇区内全部记录已是无效记录
+    flash_write(sector, victim, sizeof(uint16_t), (const uint8_t *)&retired);
+    sector->oldest_index = next_index(sector, sector->oldest_index);
+    sector->dirty_bytes -= (sector->sector_size - TLV_SECTOR_HEADER_SIZE);
+    sector->dirty_blocks -= sector->gc_blocks;
+    sector->gc_address = INVALID_ADDRESS;
+    stats_add(sector, gc_count, 1);
+#if FLASH_TLV_USE_CACHE
+    // 缓存的数据域地址仍指向旧扇区
+    invalidate_cache(&sector->cache);
+#endif
+#if FLASH_TLV_USE_COLD
+    index_cool(&sector->index);
+#endif
+#if FLASH_TLV_USE_SUMMARY
+    write_summary(sector);
+#endif
+    log("gc done: %d", free_space(sector));
+    return true;
+}
+
+/**
+ * @brief 按walk的范围输出一条有效记录：冷区中被热区覆盖的tag跳过，有缓冲区时先读取数据域
+ * @param address 记录Meta域地址
+ * @return false:回调要求停止遍历
+ * */
+static bool visit_record(tlv_sector_t *sector, tlv_walk_t *walk, uint32_t address, tlv_block_t *block) {
+    tlv_block_t probe;
+    uint16_t length;
+
+    if(walk->shadow != NULL) {
+        probe.tag = block->tag;
+        if(search_tlv(walk->shadow, &probe, TLV_BLOCK_QUERY) == TLV_RESULT_OK) {
+            return true;
+        }
+    }
+    block->entity = (address + TLV_MEAT_SIZE);
+    if(walk->buffer != NULL) {
+        length = (block->length < walk->size) ? block->length : walk->size;
+        if(length != 0) {
+            read_tlv(sector, block, walk->buffer, 0, length);
+        }
+    }
+    walk->count++;
+    return walk->visit(block, walk->buffer, walk->context);
+}
+
+/**
+ * @brief 遍历一个存储中的有效记录，见flash_tlv_foreach，调用前需要持有锁且存储已挂载
+ * @note 索引不完整时按扫描结果输出，未进入索引的tag在掉电恢复后可能存在多条有效记录，都会输出
+ * @return false:回调要求停止遍历
+ * */
+static bool walk_tlv(tlv_sector_t *sector, tlv_walk_t *walk) {
+    tlv_block_t temp_block;
+    uint32_t start_addr, end_addr;
+    uint16_t index, length;
+    bool live;
+#if FLASH_TLV_USE_INDEX
+    const index_item_t *item;
+    if(sector->index.complete) {
+        for(uint32_t i = 0; i < sector->index.count; i++) {
+            item = &sector->index.items[i];
+            if(item->tag < walk->first) {
+                continue;
+            }
+            if(item->tag > walk->last) {
+                break;
+            }
+            read_meta(sector, item->address, &temp_block);
+            temp_block.length = value_size(sector, item->address, &temp_block);
+            if(!visit_record(sector, walk, item->address, &temp_block)) {
+                return false;
+            }
+        }
+        return true;
+    }
+#endif
+    index = sector->oldest_index;
+    start_addr = (sector_address(sector, index) + TLV_SECTOR_HEADER_SIZE);
+    end_addr = sector_end(sector, start_addr);
+
+    while(1) {
+        if((start_addr >= sector->write_address) && (index == sector->work_index)) {
+            break;
+        }
+        if((start_addr + TLV_MEAT_SIZE) > end_addr) {
+            goto LAB_NEXT_SECTOR;
+        }
+        read_meta(sector, start_addr, &temp_block);
+        if(!check_tlv_block(start_addr, end_addr, &temp_block)) {
+            start_addr += TLV_MEAT_SIZE;
+            continue;
+        }
+        if(temp_block.header == HEADER_EMPTY_TLV) {
+            goto LAB_NEXT_SECTOR;
+        }
+        length = temp_block.length;
+        if((is_value(temp_block.header) || (temp_block.header == HEADER_DELTA_TLV)) &&
+           (temp_block.status == TLV_STATE_VERIFY) && (temp_block.tag >= walk->first) && (temp_block.tag <= walk->last)) {
+            live = is_value(temp_block.header);
+#if FLASH_TLV_USE_INDEX
+            // 索引中的地址才是该tag的有效记录，增量链只输出链头
+            item = index_find(&sector->index, temp_block.tag);
+            live = (live && (item == NULL)) || ((item != NULL) && (item->address == start_addr));
+#endif
+            temp_block.length = value_size(sector, start_addr, &temp_block);
+            if(live && !visit_record(sector, walk, start_addr, &temp_block)) {
+                return false;
+            }
+        }
+        start_addr += (TLV_MEAT_SIZE + length);
+        continue;
+
+        LAB_NEXT_SECTOR:
+        if(index == sector->work_index) {
+            break;
+        }
+        index = next_index(sector, index);
+        start_addr = (sector_address(sector, index) + TLV_SECTOR_HEADER_SIZE);
+        end_addr = sector_end(sector, start_addr);
+    }
+    return true;
+}
+
+#if FLASH_TLV_USE_COLD
+/**
+ * @brief 作废冷区中tag对应的记录
+ * @return true:冷区中存在该记录
+ * */
+static bool drop_cold(tlv_sector_t *sector, uint16_t tag) {
+    tlv_block_t block;
+
+    if(sector->cold == NULL) {
+        return false;
+    }
+    block.tag = tag;
+#if FLASH_TLV_USE_CACHE
+    remove_cache(&sector->cold->cache, tag);
+#endif
+    return (search_tlv(sector->cold, &block, TLV_BLOCK_DELETE) == TLV_RESULT_OK);
+}
+
+/**
+ * @brief 热度为0的记录复制到冷区，冷区中同tag的旧记录标记删除，记录从热区索引移除
+ * @note 原记录由调用者标记删除；复制完成、原记录标记删除前掉电时两处记录内容相同，查询先返回热区记录，
+ *       冷区的副本在该tag下次更新或再次移到冷区时作废
+ * @param address 源记录Meta域地址
+ * @param block 源记录Meta域
+ * @return true:已移到冷区，false:不是冷记录或冷区空间不足
+ * */
+static bool move_cold(tlv_sector_t *sector, uint32_t address, tlv_block_t *block) {
+    tlv_sector_t *cold = sector->cold;
+
+    if((cold == NULL) || (index_heat(&sector->index, block->tag) != 0)) {
+        return false;
+    }
+    if(!mount_sector(cold) || !make_space(cold, (TLV_MEAT_SIZE + block->length))) {
+        return false;
+    }
+    search_tlv(cold, block, TLV_BLOCK_MARK);
+    if(!copy_record(cold, address, block)) {
+        return false;
+    }
+    if(cold->mark_address != 0) {
+        mark_delete(cold, cold->mark_address, cold->mark_length);
+        cold->mark_address = 0;
+    }
+#if FLASH_TLV_USE_CACHE
+    remove_cache(&cold->cache, block->tag);
+    remove_cache(&sector->cache, block->tag);
+#endif
+    index_remove(&sector->index, block->tag);
+    stats_add(sector, cold_moves, 1);
+    return true;
+}
+#endif
+
+#if FLASH_TLV_USE_STREAM
+/**
+ * @brief 查找tag的值头，设置了冷区时热区未找到再查冷区
+ * @return true:tag存在且数据域是值头
+ * */
+static bool find_head(tlv_sector_t *sector, uint16_t tag, tlv_stream_head_t *head) {
+    tlv_block_t block;
+    tlv_sector_t *store = sector;
+
+    block.tag = tag;
+    if(search_tlv(sector, &block, TLV_BLOCK_QUERY) != TLV_RESULT_OK) {
+#if FLASH_TLV_USE_COLD
+        if((sector->cold == NULL) || (search_tlv(sector->cold, &block, TLV_BLOCK_QUERY) != TLV_RESULT_OK)) {
+            return false;
+        }
+        store = sector->cold;
+#else
+        return false;
+#endif
+    }
+    if(block.length != sizeof(tlv_stream_head_t)) {
+        return false;
+    }
+    flash_read(store, block.entity, sizeof(tlv_stream_head_t), (uint8_t *)head);
+    return (head->magic == TLV_STREAM_MAGIC);
+}
+
+/**
+ * @brief 从*address开始按写入顺序查找下一条已确认的分段记录，到扇区末尾时从下一个扇区继续，直到写入地址
+ * @param index 输入输出，*address所在扇区的序号
+ * @param address 输入开始查找的地址，输出找到的分段记录Meta域地址
+ * @param block 找到的分段记录Meta域
+ * @param part 找到的分段头
+ * @return false:没有更多分段
+ * */
+static bool next_part(tlv_sector_t *sector, uint16_t *index, uint32_t *address, tlv_block_t *block,
+                      tlv_part_t *part) {
+    uint32_t start_addr = *address;
+    uint32_t end_addr = sector_end(sector, sector_address(sector, *index));
+
+    while(1) {
+        if((start_addr >= sector->write_address) && (*index == sector->work_index)) {
+            return false;
+        }
+        if((start_addr + TLV_MEAT_SIZE) > end_addr) {
+            goto LAB_NEXT_SECTOR;
+        }
+        read_meta(sector, start_addr, block);
+        if(!check_tlv_block(start_addr, end_addr, block)) {
+            start_addr += TLV_MEAT_SIZE;
+            continue;
+        }
+        if(block->header == HEADER_EMPTY_TLV) {
+            goto LAB_NEXT_SECTOR;
+        }
+        if((block->header == HEADER_PART_TLV) && (block->status == TLV_STATE_VERIFY) &&
+           (block->length > sizeof(tlv_part_t))) {
+            flash_read(sector, (start_addr + TLV_MEAT_SIZE), sizeof(tlv_part_t), (uint8_t *)part);
+            *address = start_addr;
+            return true;
+        }
+        start_addr += (TLV_MEAT_SIZE + block->length);
+        continue;
+
+        LAB_NEXT_SECTOR:
+        if(*index == sector->work_index) {
+            return false;
+        }
+        *index = next_index(sector, *index);
+        start_addr = (sector_address(sector, *index) + TLV_SECTOR_HEADER_SIZE);
+        end_addr = sector_end(sector, start_addr);
+    }
+}
+
+/**
+ * @brief 作废tag的分段，保留代号为*keep的分段
+ * @param keep 保留的代号，NULL时作废tag的全部分段
+ * */
+static void drop_parts(tlv_sector_t *sector, uint16_t tag, const uint16_t *keep) {
+    tlv_block_t block;
+    tlv_part_t part;
+    uint16_t index = sector->oldest_index;
+    uint32_t address = (sector_address(sector, index) + TLV_SECTOR_HEADER_SIZE);
+
+    while(next_part(sector, &index, &address, &block, &part)) {
+        if((block.tag == tag) && ((keep == NULL) || (part.gen != *keep))) {
+            invalidate_summary(sector, address);
+            mark_delete(sector, address, block.length);
+        }
+        address += (TLV_MEAT_SIZE + block.length);
+    }
+}
+
+/**
+ * @brief 整理时判断分段是否需要复制: 属于tag当前的值头或进行中的流式写入
+ * @param address 分段记录Meta域地址
+ * @param block 分段记录Meta域
+ * */
+static bool part_live(tlv_sector_t *sector, uint32_t address, const tlv_block_t *block) {
+    tlv_stream_head_t head;
+    tlv_part_t part;
+
+    flash_read(sector, (address + TLV_MEAT_SIZE), sizeof(tlv_part_t), (uint8_t *)&part);
+    if((sector->stream != NULL) && (sector->stream->tag == block->tag) && (sector->stream->gen == part.gen)) {
+        return true;
+    }
+    return (find_head(sector, block->tag, &head) && (head.gen == part.gen));
+}
+
+/**
+ * @brief 恢复整理时补标记最旧扇区中已复制过的分段删除
+ * @note 分段不进入索引，复制分段后、标记原分段删除前掉电，重新整理会再复制一份；
+ *       之后的扇区中有tag、代号和序号都相同的已确认分段时，说明原分段已复制过
+ * */
+static void drop_copied(tlv_sector_t *sector) {
+    tlv_block_t block, copy;
+    tlv_part_t part, other;
+    uint16_t index = sector->oldest_index, other_index;
+    uint32_t address = sector->gc_address, other_addr;
+
+    while(next_part(sector, &index, &address, &block, &part) && (index == sector->oldest_index)) {
+        other_index = next_index(sector, index);
+        other_addr = (sector_address(sector, other_index) + TLV_SECTOR_HEADER_SIZE);
+        while(next_part(sector, &other_index, &other_addr, &copy, &other)) {
+            if((copy.tag == block.tag) && (other.gen == part.gen) && (other.seq == part.seq)) {
+                log("drop copied part: 0x%08x", address);
+                invalidate_summary(sector, address);
+                mark_delete(sector, address, block.length);
+                break;
+            }
+            other_addr += (TLV_MEAT_SIZE + copy.length);
+        }
+        address += (TLV_MEAT_SIZE + block.length);
+    }
+}
+
+/**
+ * @brief 填写当前分段的Meta域，校验值字段保持0xFF，分段写满后再编程
+ * */
+static void part_meta(const tlv_stream_t *stream, tlv_block_t *block) {
+    memset(block, 0xFF, sizeof(tlv_block_t));
+    block->header = HEADER_PART_TLV;
+    block->status = TLV_STATE_WRITE;
+    block->tag = stream->tag;
+    block->length = (uint16_t)(sizeof(tlv_part_t) + stream->part_length);
+    block->entity = stream->part_address;
+}
+
+/**
+ * @brief 在写入地址处打开下一个分段: 写入TLV_STATE_WRITE状态的Meta域和分段头，为分段数据预留空间
+ * @note 剩余空间放不下TLV_PART_MIN字节的分段数据时先腾出空间；预留的空间在确认前按无效记录统计，
+ *       掉电后按Meta域中的长度整体跳过
+ * @return true:分段已打开
+ * */
+static bool open_part(tlv_sector_t *sector, tlv_stream_t *stream) {
+    page_writer_t writer;
+    tlv_block_t block;
+    tlv_part_t part;
+    uint32_t remain = (stream->length - stream->offset);
+    uint32_t most = (sector->sector_size - TLV_SECTOR_HEADER_SIZE - TLV_MEAT_SIZE - sizeof(tlv_part_t));
+    uint32_t least, room;
+
+    most = (most > TLV_PART_MAX) ? TLV_PART_MAX : most;
+    most = (remain < most) ? remain : most;
+    least = (most < TLV_PART_MIN) ? most : TLV_PART_MIN;
+    if(append_space(sector) < (TLV_MEAT_SIZE + sizeof(tlv_part_t) + least)) {
+        if(!make_space(sector, (TLV_MEAT_SIZE + sizeof(tlv_part_t) + most))) {
+            return false;
+        }
+    }
+    room = (append_space(sector) - TLV_MEAT_SIZE - sizeof(tlv_part_t));
+    stream->part_length = (uint16_t)((room < most) ? room : most);
+    stream->part_offset = 0;
+    stream->part_address = sector->write_address;
+    stream->part_version = sector->work_version;
+    part_meta(stream, &block);
+    part.gen = stream->gen;
+    part.seq = stream->part_seq;
+
+    page_begin(&writer, block.entity);
+    page_put(sector, &writer, (const uint8_t *)&block, TLV_MEAT_SIZE);
+    page_put(sector, &writer, (const uint8_t *)&part, sizeof(tlv_part_t));
+    page_flush(sector, &writer);
+    sector->write_address = (block.entity + TLV_MEAT_SIZE + block.length);
+    sector->dirty_bytes += (TLV_MEAT_SIZE + block.length);
+    sector->dirty_blocks++;
+    stream->part_crc = record_crc_update(record_crc_begin(&block), (const uint8_t *)&part, sizeof(tlv_part_t));
+    return true;
+}
+
+/**
+ * @brief 当前分段所在的扇区没有被整理回收(扇区头和打开分段时相同)，进行中的整理也还没有处理到它
+ * @note 整理跳过TLV_STATE_WRITE状态的分段，越过之后再确认的分段会随扇区一起被回收
+ * */
+static bool part_intact(tlv_sector_t *sector, const tlv_stream_t *stream) {
+    tlv_sector_header_t header;
+    uint32_t end = sector_end(sector, stream->part_address);
+    uint32_t base = (end - sector->sector_size);
+
+    if((sector->gc_address != INVALID_ADDRESS) && (sector_end(sector, sector->gc_address) == end) &&
+       (sector->gc_address > stream->part_address)) {
+        return false;
+    }
+    flash_read(sector, base, TLV_SECTOR_HEADER_SIZE, (uint8_t *)&header);
+    return ((header.tag == TLV_SECTOR_TAG) && (header.version == stream->part_version));
+}
+
+/**
+ * @brief 确认写满的分段: 编程校验值，回读校验后状态变为TLV_STATE_VERIFY
+ * @return true:分段已确认
+ * */
+static bool close_part(tlv_sector_t *sector, tlv_stream_t *stream) {
+    tlv_block_t block;
+    record_crc_t crc = (record_crc_t)stream->part_crc;
+
+    part_meta(stream, &block);
+    record_crc_stored(&block) = crc;
+    // 校验值字段写入Meta域时为0xFF，可以直接编程
+    flash_write(sector, (block.entity + record_crc_offset), sizeof(record_crc_t), (const uint8_t *)&crc);
+    if(!verify_record(sector, &block, NULL)) {
+        return false;
+    }
+    set_status(sector, block.entity, TLV_STATE_VERIFY);
+    invalidate_summary(sector, block.entity);
+    sector->dirty_bytes -= (TLV_MEAT_SIZE + block.length);
+    sector->dirty_blocks--;
+    sector->live_bytes += (TLV_MEAT_SIZE + block.length);
+    stream->part_seq++;
+    stream->part_address = INVALID_ADDRESS;
+    return true;
+}
+
+/**
+ * @brief 开始流式写入，见flash_tlv_write_begin，调用前需要持有独占锁
+ * @note 新值的代号为旧值头的代号加1，开始前作废不属于旧值头的分段(之前放弃或掉电残留的)，避免代号重复
+ * */
+static bool stream_begin(tlv_sector_t *sector, tlv_stream_t *stream, uint16_t tag, uint32_t length) {
+    tlv_stream_head_t head;
+    bool found;
+
+    if(!mount_sector(sector) || (sector->stream != NULL)) {
+        return false;
+    }
+    found = find_head(sector, tag, &head);
+    drop_parts(sector, tag, (found ? &head.gen : NULL));
+    stream->sector = sector;
+    stream->tag = tag;
+    stream->gen = found ? (uint16_t)(head.gen + 1) : 0;
+    stream->length = length;
+    stream->offset = 0;
+    stream->crc = 0;
+    stream->value_crc = 0;
+    stream->part_address = INVALID_ADDRESS;
+    stream->part_seq = 0;
+    stream->part_length = 0;
+    stream->part_offset = 0;
+    stream->part_version = 0;
+    stream->part_crc = 0;
+    sector->stream = stream;
+    return true;
+}
+
+/**
+ * @brief 写入值的下一段内容，见flash_tlv_write_chunk，调用前需要持有独占锁
+ * */
+static bool stream_write(tlv_sector_t *sector, tlv_stream_t *stream, const uint8_t *data, uint32_t length) {
+    uint32_t trunk;
+
+    if((sector->stream != stream) || (length > (stream->length - stream->offset)) || !mount_sector(sector)) {
+        return false;
+    }
+    while(length) {
+        if(stream->part_address == INVALID_ADDRESS) {
+            if(!open_part(sector, stream)) {
+                return false;
+            }
+        }else if(!part_intact(sector, stream)) {
+            log("stream part lost: 0x%08x", stream->part_address);
+            return false;
+        }
+        trunk = (stream->part_length - stream->part_offset);
+        trunk = (length > trunk) ? trunk : length;
+        flash_write(sector, (stream->part_address + TLV_MEAT_SIZE + sizeof(tlv_part_t) + stream->part_offset),
+                    trunk, data);
+        stream->part_crc = record_crc_update((record_crc_t)stream->part_crc, data, trunk);
+        stream->crc = calc_crc32c(stream->crc, data, trunk);
+        stream->part_offset += trunk;
+        stream->offset += trunk;
+        data += trunk;
+        length -= trunk;
+        if((stream->part_offset == stream->part_length) && !close_part(sector, stream)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 结束流式写入，见flash_tlv_write_end，调用前需要持有独占锁
+ * @note 值头和普通记录一样追加，旧值头(或旧的普通记录)随之标记删除
+ * */
+static bool stream_end(tlv_sector_t *sector, tlv_stream_t *stream) {
+    tlv_stream_head_t head;
+
+    if((sector->stream != stream) || (stream->offset != stream->length) || !mount_sector(sector)) {
+        return false;
+    }
+    head.magic = TLV_STREAM_MAGIC;
+    head.length = stream->length;
+    head.value_crc = stream->crc;
+    head.gen = stream->gen;
+    head.parts = stream->part_seq;
+    if(!append_tlv(sector, stream->tag, (const uint8_t *)&head, sizeof(tlv_stream_head_t))) {
+        return false;
+    }
+    sector->stream = NULL;
+    drop_parts(sector, stream->tag, &stream->gen);
+    return true;
+}
+
+/**
+ * @brief 放弃流式写入，已确认的分段标记删除
+ * */
+static void stream_abort(tlv_sector_t *sector, tlv_stream_t *stream) {
+    tlv_stream_head_t head;
+
+    if(sector->stream != stream) {
+        return;
+    }
+    sector->stream = NULL;
+    if(mount_sector(sector)) {
+        drop_parts(sector, stream->tag, (find_head(sector, stream->tag, &head) ? &head.gen : NULL));
+    }
+    log("stream abort: 0x%04x", stream->tag);
+}
+
+/**
+ * @brief 确认stream->part_address仍是当前分段，分段被整理移动后按代号和序号重新查找
+ * @return true:part_address和part_length有效
+ * */
+static bool locate_part(tlv_sector_t *sector, tlv_stream_t *stream) {
+    tlv_block_t block;
+    tlv_part_t part;
+    uint16_t index;
+    uint32_t address;
+
+    if(stream->part_address != INVALID_ADDRESS) {
+        read_meta(sector, stream->part_address, &block);
+        flash_read(sector, (stream->part_address + TLV_MEAT_SIZE), sizeof(tlv_part_t), (uint8_t *)&part);
+        if((block.header == HEADER_PART_TLV) && (block.status == TLV_STATE_VERIFY) && (block.tag == stream->tag) &&
+           (part.gen == stream->gen) && (part.seq == stream->part_seq)) {
+            return true;
+        }
+    }
+    index = sector->oldest_index;
+    address = (sector_address(sector, index) + TLV_SECTOR_HEADER_SIZE);
+    while(next_part(sector, &index, &address, &block, &part)) {
+        if((block.tag == stream->tag) && (part.gen == stream->gen) && (part.seq == stream->part_seq)) {
+            stream->part_address = address;
+            stream->part_length = (uint16_t)(block.length - sizeof(tlv_part_t));
+            return true;
+        }
+        address += (TLV_MEAT_SIZE + block.length);
+    }
+    stream->part_address = INVALID_ADDRESS;
+    return false;
+}
+
+/**
+ * @brief 读取值的下一段内容，见flash_tlv_read_chunk，调用前需要持有锁且存储已挂载
+ * */
+static uint32_t stream_read(tlv_sector_t *sector, tlv_stream_t *stream, uint8_t *buffer, uint32_t length) {
+    uint32_t trunk, total = 0;
+
+    if(length > (stream->length - stream->offset)) {
+        length = (stream->length - stream->offset);
+    }
+    while(length) {
+        if(!locate_part(sector, stream) || (stream->part_offset >= stream->part_length)) {
+            break;
+        }
+        trunk = (stream->part_length - stream->part_offset);
+        trunk = (length > trunk) ? trunk : length;
+        flash_read(sector, (stream->part_address + TLV_MEAT_SIZE + sizeof(tlv_part_t) + stream->part_offset),
+                   trunk, buffer);
+        stream->crc = calc_crc32c(stream->crc, buffer, trunk);
+        stream->part_offset += trunk;
+        stream->offset += trunk;
+        buffer += trunk;
+        length -= trunk;
+        total += trunk;
+        if(stream->part_offset == stream->part_length) {
+            stream->part_seq++;
+            stream->part_address = INVALID_ADDRESS;
+            stream->part_offset = 0;
+        }
+    }
+    return total;
+}
+#endif
+
+#if FLASH_TLV_USE_DELTA
+/**
+ * @return true:address处能放下一条记录的Meta域且位于某个扇区的数据区内
+ * */
+static bool in_store(const tlv_sector_t *sector, uint32_t address) {
+    uint32_t base;
+    for(uint16_t i = 0; i < sector->sector_count; i++) {
+        base = sector_address(sector, i);
+        if((address >= (base + TLV_SECTOR_HEADER_SIZE)) && ((address + TLV_MEAT_SIZE) <= (base + sector->sector_size))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 从链头回溯到完整记录，得到整条增量链
+ * @note 不检查记录状态，删除中途掉电的链仍能完整回溯；address为完整记录(包括压缩记录)时得到只有一条记录的链
+ * @param address 链头Meta域地址
+ * @return false:链已损坏(记录头、tag或前一条记录地址不匹配，链超过TLV_DELTA_MAX条增量记录)
+ * */
+static bool load_chain(tlv_sector_t *sector, uint32_t address, tlv_chain_t *chain) {
+    tlv_block_t block;
+    tlv_delta_t delta;
+    uint16_t tag = 0, slot = (TLV_DELTA_MAX + 1);
+
+    while(slot != 0) {
+        if(!in_store(sector, address)) {
+            return false;
+        }
+        read_meta(sector, address, &block);
+        if((slot <= TLV_DELTA_MAX) && (block.tag != tag)) {
+            return false;
+        }
+        tag = block.tag;
+        slot--;
+        chain->links[slot].address = address;
+        chain->links[slot].length = block.length;
+        chain->links[slot].offset = 0;
+        if(is_value(block.header)) {
+            chain->packed = (block.header != HEADER_VALID_TLV);
+            if(chain->packed && (slot != TLV_DELTA_MAX)) {
+                return false;
+            }
+            if(slot == TLV_DELTA_MAX) {
+                chain->size = value_size(sector, address, &block);
+            }
+            chain->count = (TLV_DELTA_MAX + 1 - slot);
+            memmove(&chain->links[0], &chain->links[slot], (chain->count * sizeof(tlv_link_t)));
+            return true;
+        }
+        if((block.header != HEADER_DELTA_TLV) || (block.length < sizeof(tlv_delta_t)) ||
+           (((uint32_t)TLV_MEAT_SIZE + block.length) > sector->sector_size)) {
+            return false;
+        }
+        flash_read(sector, (address + TLV_MEAT_SIZE), sizeof(tlv_delta_t), (uint8_t *)&delta);
+        if(slot == TLV_DELTA_MAX) {
+            chain->size = delta.size;
+        }
+        chain->links[slot].offset = delta.offset;
+        address = delta.prev;
+    }
+    return false;
+}
+
+/**
+ * @brief 按增量链把合并后的值中[offset, offset + length)读到buffer，后写入的补丁覆盖之前的内容
+ * @param sector 增量链所在的存储
+ * */
+static void merge_chain(tlv_sector_t *sector, const tlv_chain_t *chain, uint8_t *buffer, uint32_t offset,
+                        uint32_t length) {
+    const tlv_link_t *link;
+    uint32_t skip, first, last;
+#if FLASH_TLV_USE_COMPRESS
+    if(chain->packed) {
+        unpack_value(sector, chain->links[0].address, chain->links[0].length, buffer, offset, length);
+        return;
+    }
+#endif
+
+    for(uint16_t i = 0; i < chain->count; i++) {
+        link = &chain->links[i];
+        skip = (i == 0) ? 0 : sizeof(tlv_delta_t);
+        first = (offset > link->offset) ? offset : link->offset;
+        last = (link->offset + link->length - skip);
+        last = ((offset + length) < last) ? (offset + length) : last;
+        if(first < last) {
+            flash_read(sector, (link->address + TLV_MEAT_SIZE + skip + (first - link->offset)), (last - first),
+                       (buffer + (first - offset)));
+        }
+    }
+}
+
+/**
+ * @brief 标记整条增量链删除，先删除完整记录再按写入顺序删除增量记录
+ * @note 中途掉电时剩下的增量记录回溯不到完整记录，挂载时作为孤立记录回收
+ * */
+static void drop_chain(tlv_sector_t *sector, const tlv_chain_t *chain) {
+    uint32_t reserve = (chain->count > 1) ? (TLV_MEAT_SIZE + chain->size) : 0;
+
+    for(uint16_t i = 0; i < chain->count; i++) {
+        mark_delete(sector, chain->links[i].address, chain->links[i].length);
+    }
+    sector->delta_reserve -= (reserve > sector->delta_reserve) ? sector->delta_reserve : reserve;
+}
+
+/**
+ * @brief 挂载扫描时确认一条已确认的增量记录：前一条记录是tag当前的链头时成为新的链头，否则标记删除
+ * @note 完整记录因索引已满没有进入索引时，移出一个没有增量链的tag为增量链腾出索引项
+ * @param address 增量记录Meta域地址
+ * @return true:增量记录有效
+ * */
+static bool scan_delta(tlv_sector_t *sector, uint32_t address, const tlv_block_t *block) {
+    const index_item_t *item;
+    tlv_block_t prev;
+    tlv_delta_t delta;
+    uint16_t size;
+
+    if(block->length >= sizeof(tlv_delta_t)) {
+        flash_read(sector, (address + TLV_MEAT_SIZE), sizeof(tlv_delta_t), (uint8_t *)&delta);
+        item = index_find(&sector->index, block->tag);
+        if((item == NULL) && !sector->index.complete && in_store(sector, delta.prev)) {
+            read_meta(sector, delta.prev, &prev);
+            if((prev.tag == block->tag) && (prev.status == TLV_STATE_VERIFY) &&
+               ((prev.header == HEADER_VALID_TLV) || (prev.header == HEADER_DELTA_TLV))) {
+                for(uint32_t i = sector->index.count; (i != 0) && (sector->index.count >= TLV_INDEX_MAX); i--) {
+                    read_meta(sector, sector->index.items[i - 1].address, &prev);
+                    if(is_value(prev.header)) {
+                        index_remove(&sector->index, prev.tag);
+                    }
+                }
+                read_meta(sector, delta.prev, &prev);
+                index_update(&sector->index, block->tag, delta.prev, prev.length);
+                item = index_find(&sector->index, block->tag);
+            }
+        }
+        if((item != NULL) && (item->address == delta.prev)) {
+            read_meta(sector, delta.prev, &prev);
+            if(prev.header == HEADER_VALID_TLV) {
+                sector->delta_reserve += (TLV_MEAT_SIZE + delta.size);
+            }else {
+                size = value_size(sector, delta.prev, &prev);
+                sector->delta_reserve += (delta.size > size) ? (delta.size - size) : 0;
+            }
+            index_update(&sector->index, block->tag, address, block->length);
+            return true;
+        }
+    }
+    // 前一条记录已被删除或被更新的值替代
+    set_status(sector, address, TLV_STATE_DELETE);
+    return false;
+}
+
+/**
+ * @brief 读取增量链头的合并值，见read_value
+ * @param block 链头，entity为数据域地址，length为合并后的值长度
+ * */
+static bool read_chain(tlv_sector_t *sector, const tlv_block_t *block, uint8_t *buffer, uint32_t offset,
+                       uint32_t length) {
+    tlv_chain_t chain;
+    if(!load_chain(sector, (block->entity - TLV_MEAT_SIZE), &chain) || (chain.size != block->length)) {
+        return false;
+    }
+    merge_chain(sector, &chain, buffer, offset, length);
+    return true;
+}
+
+/**
+ * @brief 逐条校验增量链上的记录，见verify_tlv
+ * */
+static bool verify_chain(tlv_sector_t *sector, const tlv_block_t *block) {
+    tlv_chain_t chain;
+    tlv_block_t link;
+    if(!load_chain(sector, (block->entity - TLV_MEAT_SIZE), &chain)) {
+        return false;
+    }
+    for(uint16_t i = 0; i < chain.count; i++) {
+        read_meta(sector, chain.links[i].address, &link);
+        link.entity = (chain.links[i].address + TLV_MEAT_SIZE);
+        if(!verify_data(sector, &link)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief 在写入地址处写入一条TLV_STATE_WRITE状态的完整记录，数据域为source中的增量链与补丁合并后的值，写入地址后移
+ * @note 按页边界分段合并，RAM中只暂存一页；不回读校验
+ * @param source 增量链所在的存储，可以是冷区
+ * @param chain 旧值，count为0时没有旧值
+ * @param patch 覆盖在旧值上的补丁，可以为NULL
+ * @param block 需要填写tag和length(合并后的值长度)，完成后entity为Meta域地址
+ * */
+static void fold_record(tlv_sector_t *sector, tlv_sector_t *source, const tlv_chain_t *chain,
+                        const tlv_patch_t *patch, tlv_block_t *block) {
+    page_writer_t writer;
+    record_crc_t crc;
+    uint8_t *data;
+    uint32_t room, trunk, first, last, offset = 0;
+    uint16_t tag = block->tag, length = block->length;
+
+    memset(block, 0xFF, sizeof(tlv_block_t));
+    block->header = HEADER_VALID_TLV;
+    block->status = TLV_STATE_WRITE;
+    block->tag = tag;
+    block->length = length;
+    block->entity = sector->write_address;
+    crc = record_crc_begin(block);
+    page_begin(&writer, block->entity);
+    page_put(sector, &writer, (const uint8_t *)block, TLV_MEAT_SIZE);
+    while(offset < length) {
+        room = TLV_PAGE_SIZE - ((writer.address + writer.length) % TLV_PAGE_SIZE);
+        trunk = ((length - offset) > room) ? room : (length - offset);
+        data = (writer.page + writer.length);
+        merge_chain(source, chain, data, offset, trunk);
+        if(patch != NULL) {
+            first = (offset > patch->offset) ? offset : patch->offset;
+            last = (patch->offset + patch->length);
+            last = ((offset + trunk) < last) ? (offset + trunk) : last;
+            if(first < last) {
+                memcpy((data + (first - offset)), (patch->data + (first - patch->offset)), (last - first));
+            }
+        }
+        crc = record_crc_update(crc, data, trunk);
+        writer.length += trunk;
+        if(trunk == room) {
+            page_flush(sector, &writer);
+        }
+        offset += trunk;
+    }
+    page_flush(sector, &writer);
+    record_crc_stored(block) = crc;
+    flash_write(sector, (block->entity + record_crc_offset), sizeof(record_crc_t), (const uint8_t *)&crc);
+    sector->write_address = (block->entity + TLV_MEAT_SIZE + length);
+}
+
+/**
+ * @brief 整理时把增量链折叠为一条完整记录写入工作扇区，然后标记整条链删除
+ * @note 工作扇区空间不足时启用下一个空闲扇区，与copy_record相同
+ * @return true:折叠完成
+ * */
+static bool fold_chain(tlv_sector_t *sector, const tlv_chain_t *chain, uint16_t tag) {
+    tlv_block_t block;
+
+    if(free_space(sector) < ((uint32_t)TLV_MEAT_SIZE + chain->size)) {
+        if(free_sectors(sector) == 0) {
+            return false;
+        }
+        open_sector(sector);
+    }
+    block.tag = tag;
+    block.length = chain->size;
+    fold_record(sector, sector, chain, NULL, &block);
+    set_status(sector, block.entity, TLV_STATE_VERIFY);
+    index_update(&sector->index, tag, block.entity, block.length);
+    sector->live_bytes += (TLV_MEAT_SIZE + block.length);
+    drop_chain(sector, chain);
+#if FLASH_TLV_USE_CACHE
+    remove_cache(&sector->cache, tag);
+#endif
+    stats_add(sector, delta_folds, 1);
+    return true;
+}
+
+/**
+ * @brief 开始整理前把所有增量链折叠为完整记录
+ * @note 只剩一个空闲扇区时append_space预留了delta_reserve，工作扇区放得下全部折叠结果
+ * */
+static void fold_all(tlv_sector_t *sector) {
+    const index_item_t *item;
+    tlv_chain_t chain;
+    tlv_block_t block;
+
+    for(uint32_t i = 0; (i < sector->index.count) && (sector->delta_reserve != 0); i++) {
+        item = &sector->index.items[i];
+        read_meta(sector, item->address, &block);
+        if((block.header == HEADER_DELTA_TLV) && load_chain(sector, item->address, &chain) &&
+           !fold_chain(sector, &chain, block.tag)) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief 在写入地址处写入一条TLV_STATE_WRITE状态的增量记录并回读校验，写入地址后移
+ * @param chain 当前的增量链，新记录链接到链头之后
+ * @param size 应用补丁后的值长度
+ * @param block 需要填写tag，完成后entity为Meta域地址
+ * @return true:校验通过
+ * */
+static bool write_delta(tlv_sector_t *sector, const tlv_chain_t *chain, const tlv_patch_t *patch, uint16_t size,
+                        tlv_block_t *block) {
+    page_writer_t writer;
+    tlv_delta_t delta;
+    uint16_t tag = block->tag;
+
+    delta.prev = chain->links[chain->count - 1].address;
+    delta.offset = patch->offset;
+    delta.size = size;
+    memset(block, 0xFF, sizeof(tlv_block_t));
+    block->header = HEADER_DELTA_TLV;
+    block->status = TLV_STATE_WRITE;
+    block->tag = tag;
+    block->length = (sizeof(tlv_delta_t) + patch->length);
+    block->entity = sector->write_address;
+    record_crc_stored(block) = record_crc_update(record_crc_update(record_crc_begin(block),
+        (const uint8_t *)&delta, sizeof(tlv_delta_t)), patch->data, patch->length);
+    page_begin(&writer, block->entity);
+    page_put(sector, &writer, (const uint8_t *)block, TLV_MEAT_SIZE);
+    page_put(sector, &writer, (const uint8_t *)&delta, sizeof(tlv_delta_t));
+    page_put(sector, &writer, patch->data, patch->length);
+    page_flush(sector, &writer);
+    sector->write_address = (block->entity + TLV_MEAT_SIZE + block->length);
+    return verify_record(sector, block, NULL);
+}
+
+/**
+ * @brief 确认write_delta写入的增量记录，成为tag新的链头，更新索引和缓存
+ * @param reserve 折叠这条链需要的空间的增加量
+ * */
+static void commit_delta(tlv_sector_t *sector, tlv_block_t *block, uint16_t size, uint32_t reserve) {
+    set_status(sector, block->entity, TLV_STATE_VERIFY);
+    block->status = TLV_STATE_VERIFY;
+    index_update(&sector->index, block->tag, block->entity, block->length);
+    sector->live_bytes += (TLV_MEAT_SIZE + block->length);
+    sector->delta_reserve += reserve;
+    block->entity += TLV_MEAT_SIZE;
+    block->length = size;
+#if FLASH_TLV_USE_CACHE
+    set_cache(&sector->cache, block->tag, block);
+#endif
+#if FLASH_TLV_USE_COLD
+    index_touch(&sector->index, block->tag);
+#endif
+}
+
+/**
+ * @brief 修改tag的值，见flash_tlv_patch/flash_tlv_extend，调用前需要持有独占锁
+ * @note 值在热区索引中时写入增量记录；没有进入索引(冷区、索引已满)、链上已有TLV_DELTA_MAX条增量记录、
+ *       补丁不比值短、旧值是压缩记录、整理进行中或折叠预留超过上限时，把旧值和补丁合并写入一条完整记录
+ * @param extend true:补丁追加到值末尾，忽略patch->offset
+ * */
+static bool patch_tlv(tlv_sector_t *sector, uint16_t tag, tlv_patch_t *patch, bool extend) {
+    const index_item_t *item;
+    tlv_sector_t *source;
+    tlv_chain_t chain;
+    tlv_block_t block;
+    uint32_t size, need, reserve;
+    uint16_t rounds = 0;
+    bool fold;
+
+    if((patch->length == 0) || !mount_sector(sector)) {
+        return false;
+    }
+    while(1) {
+        source = sector;
+        chain.count = 0;
+        chain.size = 0;
+        chain.packed = false;
+        block.tag = tag;
+        item = index_find(&sector->index, tag);
+        if(item != NULL) {
+            if(!load_chain(sector, item->address, &chain)) {
+                return false;
+            }
+        }else if(search_tlv(sector, &block, TLV_BLOCK_QUERY) == TLV_RESULT_OK) {
+            if(!load_chain(sector, (block.entity - TLV_MEAT_SIZE), &chain)) {
+                return false;
+            }
+        }
+#if FLASH_TLV_USE_COLD
+        else if((sector->cold != NULL) && (search_tlv(sector->cold, &block, TLV_BLOCK_QUERY) == TLV_RESULT_OK)) {
+            source = sector->cold;
+            if(!load_chain(source, (block.entity - TLV_MEAT_SIZE), &chain)) {
+                return false;
+            }
+        }
+#endif
+        if(extend) {
+            patch->offset = chain.size;
+        }
+        if(patch->offset > chain.size) {
+            return false;
+        }
+        size = (patch->offset + patch->length);
+        size = (size > chain.size) ? size : chain.size;
+        if((size >= 0xFFFF) || ((TLV_MEAT_SIZE + size) > (sector->sector_size - TLV_SECTOR_HEADER_SIZE))) {
+            return false;
+        }
+        // 新的增量链预留折叠后的整条记录，已有的链只预留值变长的部分
+        reserve = (chain.count == 1) ? (TLV_MEAT_SIZE + size) : (size - chain.size);
+        fold = ((item == NULL) || (chain.count > TLV_DELTA_MAX) || ((sizeof(tlv_delta_t) + patch->length) >= size) ||
+                chain.packed ||
+                (sector->gc_address != INVALID_ADDRESS) ||
+                ((sector->delta_reserve + reserve) > ((sector->sector_size - TLV_SECTOR_HEADER_SIZE) / TLV_DELTA_RATIO)));
+        need = fold ? (TLV_MEAT_SIZE + size) : (TLV_MEAT_SIZE + sizeof(tlv_delta_t) + patch->length + reserve);
+        if(append_space(sector) >= need) {
+            break;
+        }
+        // 整理可能折叠或移走旧值，整理后重新读取
+        if((rounds++ > 1) || !make_space(sector, need)) {
+            return false;
+        }
+    }
+    block.tag = tag;
+    if(fold) {
+        // 只标记热区中的旧值，冷区中的旧值由commit_record作废
+        search_tlv(sector, &block, TLV_BLOCK_MARK);
+        block.tag = tag;
+        block.length = size;
+        fold_record(sector, source, &chain, patch, &block);
+        if(!verify_record(sector, &block, NULL)) {
+            return false;
+        }
+        commit_record(sector, &block, NULL);
+        if(chain.count > 1) {
+            stats_add(sector, delta_folds, 1);
+        }
+        return true;
+    }
+    if(!write_delta(sector, &chain, patch, size, &block)) {
+        return false;
+    }
+    commit_delta(sector, &block, size, reserve);
+    return true;
+}
+#endif
+
+#if FLASH_TLV_USE_COMPRESS
+/**
+ * @brief 压缩输出回调: 暂存写入并累计校验值
+ * */
+static void pack_output(void *context, const uint8_t *data, uint32_t length) {
+    pack_writer_t *pack = (pack_writer_t *)context;
+    pack->crc = record_crc_update(pack->crc, data, length);
+    page_put(pack->sector, &pack->writer, data, length);
+}
+
+/**
+ * @brief 解压输入回调: 从Flash读取压缩数据
+ * */
+static void pack_input(void *context, uint32_t offset, uint8_t *buffer, uint32_t length) {
+    pack_reader_t *reader = (pack_reader_t *)context;
+    flash_read(reader->sector, (reader->address + offset), length, buffer);
+}
+
+/**
+ * @brief 在block->entity处写入一条TLV_STATE_WRITE状态的压缩记录并回读校验，写入地址后移
+ * @note 边压缩边按页编程，数据域写完后再编程Meta域中的校验值
+ * @param block 需要填写tag、length(压缩后的数据域长度)和entity(Meta域地址)
+ * @param data 原始值
+ * @param length 原始值长度
+ * @return true:校验通过
+ * */
+static bool write_packed(tlv_sector_t *sector, tlv_block_t *block, const uint8_t *data, uint16_t length) {
+    pack_writer_t pack;
+    tlv_pack_t head;
+    uint16_t tag = block->tag, stored = block->length;
+    uint32_t entity = block->entity;
+
+    memset(block, 0xFF, sizeof(tlv_block_t));
+    block->header = HEADER_PACKED_TLV;
+    block->status = TLV_STATE_WRITE;
+    block->tag = tag;
+    block->length = stored;
+    block->entity = entity;
+    head.length = length;
+    pack.sector = sector;
+    pack.crc = record_crc_update(record_crc_begin(block), (const uint8_t *)&head, sizeof(tlv_pack_t));
+    page_begin(&pack.writer, entity);
+    page_put(sector, &pack.writer, (const uint8_t *)block, TLV_MEAT_SIZE);
+    page_put(sector, &pack.writer, (const uint8_t *)&head, sizeof(tlv_pack_t));
+    lz_compress(data, length, pack_output, &pack);
+    page_flush(sector, &pack.writer);
+    record_crc_stored(block) = pack.crc;
+    flash_write(sector, (entity + record_crc_offset), sizeof(record_crc_t), (const uint8_t *)&pack.crc);
+    sector->write_address = (entity + TLV_MEAT_SIZE + stored);
+    return verify_record(sector, block, NULL);
+}
+
+/**
+ * @brief 压缩后追加一条记录，见flash_tlv_append_packed
+ * */
+static bool append_packed(tlv_sector_t *sector, uint16_t tag, const uint8_t *data, uint16_t length) {
+    tlv_err_t status;
+    tlv_block_t block;
+    uint32_t stored = (sizeof(tlv_pack_t) + lz_compress(data, length, NULL, NULL));
+
+    if(stored >= length) {
+        return append_tlv(sector, tag, data, length);
+    }
+    // 查找可用空间
+    block.tag = tag;
+    block.length = (uint16_t)stored;
+    status = search_tlv(sector, &block, TLV_BLOCK_APPEND);
+    if(status != TLV_RESULT_OK) {
+        if((status != TLV_DATA_SPACE_LOW) || !make_space(sector, (TLV_MEAT_SIZE + stored))) {
+            return false;
+        }
+        status = search_tlv(sector, &block, TLV_BLOCK_APPEND);
+        if(status != TLV_RESULT_OK) {
+            return false;
+        }
+    }
+    if(!write_packed(sector, &block, data, length)) {
+        return false;
+    }
+    commit_record(sector, &block, NULL);
+    stats_add(sector, packed_saved, (length - stored));
+    // 索引中是存储长度，缓存中是原始值长度，与查询结果相同
+    block.length = length;
+#if FLASH_TLV_USE_CACHE
+    set_cache(&sector->cache, tag, &block);
+#endif
+#if FLASH_TLV_USE_VALUE_CACHE
+    set_value(&sector->cache, &block, data);
+#endif
+    return true;
+}
+
+/**
+ * @brief 解压address处的压缩记录，把原始值中[offset, offset + length)读到buffer
+ * @note 每次都从压缩数据开头解压，只占用窗口大小的栈空间
+ * @param address 压缩记录Meta域地址
+ * @param stored 压缩记录数据域长度
+ * @return false:压缩数据已损坏
+ * */
+static bool unpack_value(tlv_sector_t *sector, uint32_t address, uint16_t stored, uint8_t *buffer, uint32_t offset,
+                         uint32_t length) {
+    pack_reader_t reader;
+
+    if(stored < sizeof(tlv_pack_t)) {
+        return false;
+    }
+    reader.sector = sector;
+    reader.address = (address + TLV_MEAT_SIZE + sizeof(tlv_pack_t));
+    return lz_decompress(pack_input, &reader, (stored - sizeof(tlv_pack_t)), buffer, offset, length);
+}
+
+/**
+ * @brief 读取压缩记录的原始值，见read_value
+ * @param block 压缩记录，entity为数据域地址，length为原始值长度
+ * */
+static bool read_packed(tlv_sector_t *sector, const tlv_block_t *block, uint8_t *buffer, uint32_t offset,
+                        uint32_t length) {
+    tlv_block_t meta;
+    uint32_t address = (block->entity - TLV_MEAT_SIZE);
+
+    read_meta(sector, address, &meta);
+    if((meta.header != HEADER_PACKED_TLV) || (meta.tag != block->tag) ||
+       (value_size(sector, address, &meta) != block->length)) {
+        return false;
+    }
+    return unpack_value(sector, address, meta.length, buffer, offset, length);
+}
+
+/**
+ * @brief 校验压缩记录存储的压缩数据，见verify_tlv
+ * */
+static bool verify_packed(tlv_sector_t *sector, const tlv_block_t *block) {
+    tlv_block_t meta;
+
+    read_meta(sector, (block->entity - TLV_MEAT_SIZE), &meta);
+    if((meta.header != HEADER_PACKED_TLV) || (meta.tag != block->tag)) {
+        return false;
+    }
+    meta.entity = block->entity;
+    return verify_data(sector, &meta);
+}
+#endif
+
+/**
+ * @brief tlv扇区整理，完成进行中的整理，没有进行中的整理时完整整理最旧的一个扇区
+ * @return GC完成后工作扇区可用空间(bytes)
+ * */
+static uint32_t flash_tlv_gc(tlv_sector_t *sector) {
+#if FLASH_TLV_USE_STATS
+    uint32_t start = stats_clock(sector);
+#endif
+    if(sector->gc_address == INVALID_ADDRESS) {
+        gc_begin(sector);
+    }
+    while((sector->gc_address != INVALID_ADDRESS) && gc_run(sector, 0xFFFF));
+    stats_add(sector, gc_time_us, (stats_clock(sector) - start));
+    return free_space(sector);
+}
+
+#if FLASH_TLV_USE_SUMMARY
+/**
+ * @brief 在写入地址处写入挂载摘要: 当前计数和完整索引的快照
+ * @note 索引不完整或空间不足时不写入，挂载时找不到可用摘要就完整扫描；摘要记录写入后按无效记录统计，整理时不复制
+ * */
+static void write_summary(tlv_sector_t *sector) {
+    page_writer_t writer;
+    tlv_summary_t summary;
+    tlv_block_t block;
+    uint32_t items = (sector->index.count * sizeof(index_item_t));
+
+    if(!sector->index.complete || (sector->write_address == INVALID_ADDRESS)) {
+        return;
+    }
+    block.tag = sector->index.count;
+    block.length = (uint16_t)(sizeof(tlv_summary_t) + items);
+    if(append_space(sector) < ((uint32_t)TLV_MEAT_SIZE + block.length)) {
+        return;
+    }
+    summary.oldest_index = sector->oldest_index;
+    summary.count = sector->index.count;
+    summary.live_bytes = sector->live_bytes;
+    summary.dirty_bytes = sector->dirty_bytes;
+    summary.dirty_blocks = sector->dirty_blocks;
+#if FLASH_TLV_USE_DELTA
+    summary.delta_reserve = sector->delta_reserve;
+#endif
+
+    block.header = HEADER_SUMMARY_TLV;
+    block.status = TLV_STATE_WRITE;
+#if FLASH_TLV_USE_CRC32
+    block.crc8 = 0xFF;
+#endif
+    record_crc_stored(&block) = record_crc_update(
+            record_crc_update(record_crc_begin(&block), (const uint8_t *)&summary, sizeof(tlv_summary_t)),
+            (const uint8_t *)sector->index.items, items);
+    block.entity = sector->write_address;
+    page_begin(&writer, block.entity);
+    page_put(sector, &writer, (const uint8_t *)&block, TLV_MEAT_SIZE);
+    page_put(sector, &writer, (const uint8_t *)&summary, sizeof(tlv_summary_t));
+    page_put(sector, &writer, (const uint8_t *)sector->index.items, items);
+    page_flush(sector, &writer);
+    sector->write_address = (block.entity + TLV_MEAT_SIZE + block.length);
+    sector->dirty_bytes += (TLV_MEAT_SIZE + block.length);
+    sector->dirty_blocks++;
+    // 状态保持TLV_STATE_WRITE的摘要在挂载时被忽略
+    sector->summary_address = INVALID_ADDRESS;
+    if(verify_record(sector, &block, NULL)) {
+        set_status(sector, block.entity, TLV_STATE_VERIFY);
+        sector->summary_address = block.entity;
+    }
+}
+
+/**
+ * @brief address处的记录在摘要之后发生了摘要无法反映的变化(分段记录确认、删除或移动)，作废最后一条摘要
+ * @note 摘要之后写入的记录在挂载时重放，不需要作废；作废后挂载时完整扫描，直到写入下一条摘要
+ * @param address 发生变化的记录Meta域地址
+ * */
+static void invalidate_summary(tlv_sector_t *sector, uint32_t address) {
+    uint32_t summary = sector->summary_address;
+
+    if(summary == INVALID_ADDRESS) {
+        return;
+    }
+    if((sector_end(sector, address) == sector_end(sector, summary)) && (address > summary)) {
+        return;
+    }
+    set_status(sector, summary, TLV_STATE_DELETE);
+    sector->summary_address = INVALID_ADDRESS;
+    log("summary invalidated: 0x%08x", summary);
+}
+
+/**
+ * @return 工作扇区中最后一条摘要记录的地址，没有摘要或它未确认(写入失败、已作废)时返回INVALID_ADDRESS
+ * @note 更早的摘要之后的变化可能已不可重放，不再使用
+ * */
+static uint32_t find_summary(tlv_sector_t *sector) {
+    tlv_block_t temp_block;
+    uint32_t found = INVALID_ADDRESS;
+    uint32_t start_addr = (sector->work_sector + TLV_SECTOR_HEADER_SIZE);
+    uint32_t end_addr = sector_end(sector, start_addr);
+
+    while((start_addr + TLV_MEAT_SIZE) <= end_addr) {
+        read_meta(sector, start_addr, &temp_block);
+        if(!check_tlv_block(start_addr, end_addr, &temp_block)) {
+            start_addr += TLV_MEAT_SIZE;
+            continue;
+        }
+        if(temp_block.header == HEADER_EMPTY_TLV) {
+            break;
+        }
+        if(temp_block.header == HEADER_SUMMARY_TLV) {
+            found = (temp_block.status == TLV_STATE_VERIFY) ? start_addr : INVALID_ADDRESS;
+        }
+        start_addr += (TLV_MEAT_SIZE + temp_block.length);
+    }
+    return found;
+}
+
+#if FLASH_TLV_USE_DELTA
+/**
+ * @brief 确认摘要中索引项指向的增量链，链上有记录已标记删除时(删除中途掉电)补完删除整条链，计数变化累加到summary
+ * @param address 链头Meta域地址
+ * @return false:增量链已损坏
+ * */
+static bool restore_chain(tlv_sector_t *sector, uint32_t address, tlv_summary_t *summary) {
+    tlv_chain_t chain;
+    tlv_block_t block;
+    bool live = true;
+
+    if(!load_chain(sector, address, &chain)) {
+        return false;
+    }
+    for(uint16_t i = 0; i < chain.count; i++) {
+        read_meta(sector, chain.links[i].address, &block);
+        live = (live && (block.status == TLV_STATE_VERIFY));
+    }
+    if(live) {
+        return true;
+    }
+    for(uint16_t i = 0; i < chain.count; i++) {
+        set_status(sector, chain.links[i].address, TLV_STATE_DELETE);
+        summary->live_bytes -= (TLV_MEAT_SIZE + chain.links[i].length);
+        summary->dirty_bytes += (TLV_MEAT_SIZE + chain.links[i].length);
+        summary->dirty_blocks++;
+    }
+    summary->delta_reserve -= (TLV_MEAT_SIZE + chain.size);
+    index_remove(&sector->index, block.tag);
+    return true;
+}
+#endif
+
+/**
+ * @brief 从工作扇区最后一条摘要恢复索引和计数，只重放摘要之后的记录，结果与完整扫描相同
+ * @note 摘要之后，摘要之前的有效记录只可能被标记删除，逐条确认摘要中索引项(增量链为整条链)的状态即可(分段记录的变化会作废摘要)；
+ *       摘要之后又完成过整理(最旧扇区变化)、CRC错误或索引项与记录不符时返回false，由调用者完整扫描
+ * @return true:恢复完成，write_address有效
+ * */
+static bool load_summary(tlv_sector_t *sector) {
+    tlv_summary_t summary;
+    tlv_block_t block;
+    const index_item_t *item;
+    record_crc_t crc;
+    uint32_t items;
+    uint32_t address = find_summary(sector);
+
+    if(address == INVALID_ADDRESS) {
+        return false;
+    }
+    read_meta(sector, address, &block);
+    flash_read(sector, (address + TLV_MEAT_SIZE), sizeof(tlv_summary_t), (uint8_t *)&summary);
+    items = (summary.count * sizeof(index_item_t));
+    if((summary.oldest_index != sector->oldest_index) || (summary.count > TLV_INDEX_MAX) ||
+       (block.length != (sizeof(tlv_summary_t) + items))) {
+        return false;
+    }
+    flash_read(sector, (address + TLV_MEAT_SIZE + sizeof(tlv_summary_t)), items, (uint8_t *)sector->index.items);
+    crc = record_crc_update(record_crc_begin(&block), (const uint8_t *)&summary, sizeof(tlv_summary_t));
+    crc = record_crc_update(crc, (const uint8_t *)sector->index.items, items);
+    if(crc != record_crc_stored(&block)) {
+        return false;
+    }
+    index_restore(&sector->index, summary.count);
+    // 倒序确认，移除索引项不影响尚未确认的项
+    for(uint32_t i = sector->index.count; i > 0; i--) {
+        item = &sector->index.items[i - 1];
+        read_meta(sector, item->address, &block);
+        if((block.tag != item->tag) || (block.length != item->length)) {
+            index_reset(&sector->index);
+            return false;
+        }
+#if FLASH_TLV_USE_DELTA
+        if(block.header == HEADER_DELTA_TLV) {
+            if(!restore_chain(sector, item->address, &summary)) {
+                index_reset(&sector->index);
+                return false;
+            }
+            continue;
+        }
+#endif
+        if(!is_value(block.header)) {
+            index_reset(&sector->index);
+            return false;
+        }
+        if(block.status != TLV_STATE_VERIFY) {
+            summary.live_bytes -= (TLV_MEAT_SIZE + item->length);
+            summary.dirty_bytes += (TLV_MEAT_SIZE + item->length);
+            summary.dirty_blocks++;
+            index_remove(&sector->index, block.tag);
+        }
+    }
+    sector->live_bytes = summary.live_bytes;
+    sector->dirty_bytes = summary.dirty_bytes;
+    sector->dirty_blocks = summary.dirty_blocks;
+#if FLASH_TLV_USE_DELTA
+    sector->delta_reserve = summary.delta_reserve;
+#endif
+    sector->write_address = scan_records(sector, sector->work_sector, address);
+    sector->summary_address = address;
+    return true;
+}
+#endif
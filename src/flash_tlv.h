@@ -10,11 +10,26 @@
 
 #include "stdint.h"
 #include <stdbool.h>
+#include "spi_flash.h"
+#include "flash_tlv_config.h"
 
-#define FLASH_TLV_DEBUG        0
-#define FLASH_TLV_USE_CACHE    1
+#if FLASH_TLV_USE_INDEX
+#include "flash_tlv_index.h"
+#endif
 
 #define INVALID_ADDRESS        0xFFFFFFFF
+// 环形日志最多支持的扇区数
+#define TLV_SECTOR_MAX         32
+// 工作扇区可用空间低于扇区容量的1/TLV_GC_FREE_RATIO时，flash_tlv_gc_step开始后台整理
+#define TLV_GC_FREE_RATIO      4
+// 回读校验和flash_tlv_verify使用的栈缓冲区大小(bytes)，越大Flash读取次数越少
+#define FLASH_TLV_BUFFER_SIZE  32
+// Flash编程页大小，连续写入的数据按页合并编程，写入时占用等大的栈空间
+#define TLV_PAGE_SIZE          256
+// 一个值最多累积的增量记录数，再次修改时写入合并后的完整记录；读取时每条增量记录多一次Flash读取
+#define TLV_DELTA_MAX          8
+// 所有增量链折叠为完整记录需要的空间不超过扇区容量的1/TLV_DELTA_RATIO，超出时修改直接写入完整记录
+#define TLV_DELTA_RATIO        4
 
 typedef enum {
     TLV_RESULT_OK = 0,
@@ -24,45 +39,184 @@ typedef enum {
     TLV_DATA_SPACE_LOW,
 } tlv_err_t;
 
-#define TLV_MEAT_SIZE     8
+/**
+ * @brief 追加记录后的校验方式
+ * */
+typedef enum {
+    // 回读Meta域和数据域，与写入的数据逐字节比较(默认)
+    TLV_VERIFY_FULL = 0,
+    // 回读Meta域比较，数据域只校验存储的CRC8/CRC32C，不需要再次访问写入的数据
+    TLV_VERIFY_CRC,
+    // 不回读，适用于由硬件报告编程错误的后端
+    TLV_VERIFY_NONE,
+} tlv_verify_t;
 
-#define HEADER_EMPTY_TLV          0xFFFF
-#define HEADER_VALID_TLV          0xAA55
+#include "flash_tlv_block.h"
 
-#define TLV_STATE_NONE            0xFF
-#define TLV_STATE_WRITE           0xFE
-#define TLV_STATE_VERIFY          0xFC
-#define TLV_STATE_DELETE          0xF8
+#if FLASH_TLV_USE_CACHE
+#include "flash_tlv_cache.h"
+#endif
 
-typedef struct _tlv_block {
-    // 结构头 固定0x55 0xaa
-    uint16_t header;
-    // 结构状态
-    uint8_t status;
-    // X^8+X^2+X^1+1
-    // crc8 = calc_crc8(tag + length + entity[...])
-    uint8_t crc8;
+typedef struct _tlv_item {
     uint16_t tag;
     uint16_t length;
-    // 数据域的起始地址(此参数不存储到Flash)
-    uint32_t entity;
-} tlv_block_t;
+    const uint8_t *data;
+} tlv_item_t;
+
+/**
+ * @brief flash_tlv_foreach的回调，返回false时停止遍历
+ * @param block 有效记录，entity为数据域地址
+ * @param data 读到缓冲区的数据域，flash_tlv_foreach未提供缓冲区时为NULL
+ * */
+typedef bool (*tlv_visit_t)(const tlv_block_t *block, const uint8_t *data, void *context);
+
+#if FLASH_TLV_USE_STATS
+typedef struct _tlv_stats {
+    // Flash读/写/擦除的调用次数和字节数
+    uint32_t flash_reads;
+    uint32_t read_bytes;
+    uint32_t flash_writes;
+    uint32_t write_bytes;
+    uint32_t flash_erases;
+    // 经后端直接映射完成的读取次数(Meta域读取和flash_tlv_get_ptr)，不计入flash_reads
+    uint32_t mapped_reads;
+    // 记录缓存(flash_tlv_query)和数据域缓存(flash_tlv_read)的命中/未命中次数
+    uint32_t cache_hits;
+    uint32_t cache_misses;
+    uint32_t value_hits;
+    uint32_t value_misses;
+    // 完成整理的扇区数，整理累计耗时(us)
+    uint32_t gc_count;
+    uint32_t gc_time_us;
+    // 整理时移到冷区的记录数
+    uint32_t cold_moves;
+    // 增量链折叠为完整记录的次数(修改时达到TLV_DELTA_MAX条、开始整理时)
+    uint32_t delta_folds;
+    // 压缩记录比原始值少写入的字节数
+    uint32_t packed_saved;
+    // 单次追加/批量追加/查询/删除/后台整理的最大耗时(us)，需要后端提供clock
+    uint32_t max_latency_us;
+    // 以下字段只在flash_tlv_stats返回时填充
+    uint32_t live_bytes;
+    uint32_t dirty_bytes;
+    uint32_t free_bytes;
+} tlv_stats_t;
+#endif
+
+#if FLASH_TLV_USE_LOCK
+/**
+ * @brief 读写锁钩子，由flash_tlv_set_lock设置，未设置时不加锁
+ * @note 可以基于RTOS的读写锁实现；只有互斥锁时，四个钩子都使用同一个互斥锁(读操作之间不再并发)
+ * */
+typedef struct _tlv_lock {
+    // 共享持有: 查询、读取、校验、统计
+    void (*read_lock)(void *context);
+    void (*read_unlock)(void *context);
+    // 独占持有: 格式化、追加、删除、后台整理，以及首次访问时的挂载扫描
+    void (*write_lock)(void *context);
+    void (*write_unlock)(void *context);
+    void *context;
+} tlv_lock_t;
+#endif
 
 typedef struct _tlv_sector {
-    // 扇区1地址，对齐到'sector_size'
+    // 存储设备的后端接口
+    flash_dev_t *dev;
+    // 扇区1地址，对齐到'erase_size'，环形模式下为第一个扇区地址
     uint32_t major_sector;
-    // 扇区2地址，对齐到'sector_size'
+    // 扇区2地址，对齐到'erase_size'，环形模式下为major_sector + sector_size
     uint32_t minor_sector;
-    // 扇区大小, unit:byte
-    uint16_t sector_size;
+    // 逻辑扇区大小, unit:byte
+    uint32_t sector_size;
+    // 物理擦除块大小, unit:byte, sector_size是它的整数倍
+    uint32_t erase_size;
     // 脏块数量, 包括写入后校验失败块，标记删除块，Meta域异常坏块
-    uint16_t dirty_blocks;
-    // 当前工作扇区地址，major_sector或minor_sector其中一个
+    uint32_t dirty_blocks;
+    // 扇区数量，major/minor双扇区时为2
+    uint16_t sector_count;
+    // 追加记录后的校验方式，见tlv_verify_t
+    uint8_t verify_mode;
+    // 工作扇区(最新)和最旧扇区的序号[0, sector_count)
+    uint16_t work_index;
+    uint16_t oldest_index;
+    // 工作扇区头部的版本号，按扇区启用顺序递增
+    uint16_t work_version;
+    // 当前工作扇区地址，新记录写入此扇区
     uint32_t work_sector;
     // 写入重复Tag时，旧Tag的地址(新Tag写入完成后标记旧Tag删除)
     uint32_t mark_address;
+    // 旧Tag记录的数据域长度
+    uint16_t mark_length;
+    // 下一条记录的写入地址，挂载扫描时得到，INVALID_ADDRESS表示需要重新扫描
+    uint32_t write_address;
+    // 有效记录占用的字节数(含Meta域)
+    uint32_t live_bytes;
+    // 无效记录占用的字节数(含Meta域)，GC可回收
+    uint32_t dirty_bytes;
+    // 正在整理的最旧扇区中下一条待处理记录的地址，INVALID_ADDRESS表示没有进行中的整理
+    uint32_t gc_address;
+    // 本轮整理已处理的记录数(含Meta域异常块)
+    uint32_t gc_blocks;
+#if FLASH_TLV_USE_INDEX
+    // 所有扇区内有效记录的tag->地址索引, 挂载时扫描一次建立
+    index_obj_t index;
+#endif
+#if FLASH_TLV_USE_CACHE
+    // 本存储实例的记录缓存和数据域缓存，多个实例互不影响
+    cache_obj_t cache;
+#endif
+#if FLASH_TLV_USE_STATS
+    tlv_stats_t stats;
+#endif
+#if FLASH_TLV_USE_LOCK
+    tlv_lock_t lock;
+#endif
+#if FLASH_TLV_USE_COLD
+    // 冷区存储，NULL表示不使用冷区
+    struct _tlv_sector *cold;
+#endif
+#if FLASH_TLV_USE_SUMMARY
+    // 工作扇区中最后一条已确认的摘要记录地址，INVALID_ADDRESS表示没有
+    uint32_t summary_address;
+#endif
+#if FLASH_TLV_USE_STREAM
+    // 进行中的流式写入，NULL表示没有
+    struct _tlv_stream *stream;
+#endif
+#if FLASH_TLV_USE_DELTA
+    // 把所有增量链折叠为完整记录需要的空间(bytes)，开始整理时先折叠，只剩一个空闲扇区时预留
+    uint32_t delta_reserve;
+#endif
 } tlv_sector_t;
 
+#if FLASH_TLV_USE_STREAM
+/**
+ * @brief 流式读写状态，由flash_tlv_write_begin/flash_tlv_read_begin填写，调用者分配，不需要访问其中的字段
+ * */
+typedef struct _tlv_stream {
+    tlv_sector_t *sector;
+    uint16_t tag;
+    // 值的代号，区分同一tag新旧值的分段
+    uint16_t gen;
+    // 值的总长度和已写入/读取的字节数
+    uint32_t length;
+    uint32_t offset;
+    // 已写入/读取数据的CRC32C，读取时与值头中的value_crc比较
+    uint32_t crc;
+    uint32_t value_crc;
+    // 当前分段的Meta域地址，INVALID_ADDRESS表示需要打开(写入)或查找(读取)下一个分段
+    uint32_t part_address;
+    // 当前分段的序号、数据长度(不含分段头)和已写入/读取的字节数
+    uint16_t part_seq;
+    uint16_t part_length;
+    uint16_t part_offset;
+    // 写入时当前分段所在扇区的版本号，扇区被整理回收后不再匹配
+    uint16_t part_version;
+    // 写入时当前分段的记录校验值
+    uint32_t part_crc;
+} tlv_stream_t;
+#endif
+
 #define TLV_SECTOR_TAG            0xCAEE
 #define TLV_VERSION_MIN           0x0000
 #define TLV_VERSION_MAX           0xFFFF
@@ -73,18 +227,73 @@ typedef struct _tlv_sector_header {
     uint16_t version;
 } tlv_sector_header_t;
 
-void flash_tlv_init(tlv_sector_t *sector, uint32_t major, uint32_t minor, uint16_t size);
+void flash_tlv_init(tlv_sector_t *sector, flash_dev_t *dev, uint32_t major, uint32_t minor, uint32_t size);
+
+void flash_tlv_init_ring(tlv_sector_t *sector, flash_dev_t *dev, uint32_t base, uint16_t count, uint32_t size);
+
+bool flash_tlv_set_erase_size(tlv_sector_t *sector, uint32_t size);
+
+void flash_tlv_set_verify(tlv_sector_t *sector, tlv_verify_t mode);
+
+#if FLASH_TLV_USE_LOCK
+void flash_tlv_set_lock(tlv_sector_t *sector, const tlv_lock_t *lock);
+#endif
+
+#if FLASH_TLV_USE_COLD
+bool flash_tlv_set_cold(tlv_sector_t *sector, tlv_sector_t *cold);
+#endif
 
 void flash_tlv_format(tlv_sector_t *sector);
 
 bool flash_tlv_append(tlv_sector_t *sector, uint16_t tag, const uint8_t *data, uint16_t length);
 
+bool flash_tlv_append_batch(tlv_sector_t *sector, const tlv_item_t *items, uint16_t count);
+
+#if FLASH_TLV_USE_COMPRESS
+bool flash_tlv_append_packed(tlv_sector_t *sector, uint16_t tag, const uint8_t *data, uint16_t length);
+#endif
+
 bool flash_tlv_query(tlv_sector_t *sector, uint16_t tag, tlv_block_t *block);
 
-uint32_t flash_tlv_read(tlv_block_t *block, uint8_t *buffer, uint16_t offset, uint16_t length);
+uint32_t flash_tlv_read(tlv_sector_t *sector, tlv_block_t *block, uint8_t *buffer, uint16_t offset, uint16_t length);
 
-bool flash_tlv_verify(tlv_block_t *block);
+bool flash_tlv_get(tlv_sector_t *sector, uint16_t tag, uint8_t *buffer, uint16_t *length);
+
+const uint8_t *flash_tlv_get_ptr(tlv_sector_t *sector, const tlv_block_t *block, uint16_t *length);
+
+bool flash_tlv_verify(tlv_sector_t *sector, tlv_block_t *block);
 
 bool flash_tlv_delete(tlv_sector_t *sector, uint16_t tag);
 
+#if FLASH_TLV_USE_DELTA
+bool flash_tlv_patch(tlv_sector_t *sector, uint16_t tag, uint16_t offset, const uint8_t *data, uint16_t length);
+
+bool flash_tlv_extend(tlv_sector_t *sector, uint16_t tag, const uint8_t *data, uint16_t length);
+#endif
+
+uint32_t flash_tlv_foreach(tlv_sector_t *sector, uint16_t first, uint16_t last, uint8_t *buffer, uint16_t size,
+                           tlv_visit_t visit, void *context);
+
+bool flash_tlv_gc_step(tlv_sector_t *sector, uint16_t records);
+
+#if FLASH_TLV_USE_STREAM
+bool flash_tlv_write_begin(tlv_sector_t *sector, tlv_stream_t *stream, uint16_t tag, uint32_t length);
+
+bool flash_tlv_write_chunk(tlv_stream_t *stream, const uint8_t *data, uint32_t length);
+
+bool flash_tlv_write_end(tlv_stream_t *stream);
+
+bool flash_tlv_read_begin(tlv_sector_t *sector, tlv_stream_t *stream, uint16_t tag);
+
+uint32_t flash_tlv_read_chunk(tlv_stream_t *stream, uint8_t *buffer, uint32_t length);
+
+bool flash_tlv_read_end(const tlv_stream_t *stream);
+#endif
+
+#if FLASH_TLV_USE_STATS
+void flash_tlv_stats(tlv_sector_t *sector, tlv_stats_t *stats);
+
+void flash_tlv_stats_reset(tlv_sector_t *sector);
+#endif
+
 #endif
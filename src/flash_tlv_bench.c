@@ -0,0 +1,357 @@
+/*
+ * flash_tlv_bench.c
+ * @brief 基准测试，在NOR模拟器上扫描记录大小、tag数量、更新分布和填充率，
+ *        每种配置输出一行CSV: 吞吐、延迟分位数、每次操作的Flash读/编程/擦除次数和编程字节数
+ *       启用压缩记录时packed/unpack阶段写入和读取类似JSON的文本，与append/query比较编程字节数和擦除次数
+ * @note 用法: flash_tlv_bench [每阶段操作次数，默认2000]
+ *       延迟为模拟器时序模型得到的Flash耗时，host_ops_s为主机上实际执行速度
+ * Created on: Oct 16, 2026
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "flash_tlv.h"
+#include "flash_sim.h"
+
+#define BENCH_SECTOR_COUNT    4
+#define BENCH_GC_RECORDS      8
+#define BENCH_ZIPF_S          0.99
+// 填充记录使用的tag，不参与测试负载
+#define BENCH_BALLAST_TAG     0x8000
+// 填充记录的数据域长度，使用大记录避免占满标签索引
+#define BENCH_BALLAST_SIZE    1024
+// patch阶段每次改写的字节数
+#define BENCH_PATCH_SIZE      4
+// packed阶段写入的文本，重复的字段名可以被压缩
+#define BENCH_PACK_TEXT       "{\"id\":%u,\"mode\":\"auto\",\"level\":%u,\"enable\":true},"
+
+typedef enum {
+    SKEW_UNIFORM = 0,
+    SKEW_ZIPF,
+} bench_skew_t;
+
+typedef struct _bench_config {
+    uint16_t record_size;
+    uint16_t tag_count;
+    bench_skew_t skew;
+    double fill;
+} bench_config_t;
+
+typedef struct _bench_result {
+    uint32_t count;
+    uint64_t *latency_ns;
+    uint64_t flash_ns;
+    uint64_t host_ns;
+    flash_sim_counter_t flash;
+} bench_result_t;
+
+static const uint16_t record_sizes[] = {8, 32, 128};
+static const uint16_t tag_counts[] = {16, 64, 256};
+static const bench_skew_t skews[] = {SKEW_UNIFORM, SKEW_ZIPF};
+static const double fills[] = {0.25, 0.50, 0.75};
+
+static uint32_t rng_state = 0x12345678;
+static double *zipf_cdf;
+
+static uint32_t bench_rand(void) {
+    // xorshift32，保证每次运行的负载相同
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void zipf_setup(uint16_t tags) {
+    double sum = 0;
+    zipf_cdf = realloc(zipf_cdf, sizeof(double) * tags);
+    for(uint16_t i = 0; i < tags; i++) {
+        sum += 1.0 / pow((double)(i + 1), BENCH_ZIPF_S);
+        zipf_cdf[i] = sum;
+    }
+    for(uint16_t i = 0; i < tags; i++) {
+        zipf_cdf[i] /= sum;
+    }
+}
+
+static uint16_t next_tag(const bench_config_t *config) {
+    uint32_t low = 0, high, middle;
+    double u;
+
+    if(config->skew == SKEW_UNIFORM) {
+        return (uint16_t)(bench_rand() % config->tag_count);
+    }
+    u = (double)bench_rand() / 4294967296.0;
+    high = config->tag_count - 1;
+    while(low < high) {
+        middle = (low + high) >> 1;
+        if(zipf_cdf[middle] < u) {
+            low = middle + 1;
+        }else {
+            high = middle;
+        }
+    }
+    return (uint16_t)low;
+}
+
+static uint64_t host_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void counter_diff(flash_sim_counter_t *out, const flash_sim_counter_t *end, const flash_sim_counter_t *begin) {
+    out->read_ops += (end->read_ops - begin->read_ops);
+    out->read_bytes += (end->read_bytes - begin->read_bytes);
+    out->program_ops += (end->program_ops - begin->program_ops);
+    out->program_bytes += (end->program_bytes - begin->program_bytes);
+    out->erase_ops += (end->erase_ops - begin->erase_ops);
+}
+
+static void result_reset(bench_result_t *result, uint32_t capacity) {
+    memset(result, 0x00, sizeof(bench_result_t));
+    result->latency_ns = malloc(sizeof(uint64_t) * capacity);
+}
+
+/**
+ * @brief 记录一次操作的开销，begin为操作前的模拟器计数
+ * */
+static void result_add(bench_result_t *result, const flash_sim_t *sim, const flash_sim_counter_t *begin,
+                       uint64_t flash_begin, uint64_t host_begin) {
+    uint64_t elapsed = (sim->elapsed_ns - flash_begin);
+    result->latency_ns[result->count++] = elapsed;
+    result->flash_ns += elapsed;
+    result->host_ns += (host_now() - host_begin);
+    counter_diff(&result->flash, &sim->total, begin);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief 输出一行结果，没有样本的阶段不输出；全部命中缓存没有Flash耗时的阶段flash_ops_s留空，只看host_ops_s
+ * */
+static void result_print(const bench_config_t *config, uint32_t sector_size, const char *op, bench_result_t *result) {
+    double count = result->count;
+    uint64_t p50, p99, max;
+    char flash_ops[32] = "";
+
+    if(result->count == 0) {
+        free(result->latency_ns);
+        return;
+    }
+    qsort(result->latency_ns, result->count, sizeof(uint64_t), compare_u64);
+    p50 = result->latency_ns[(result->count - 1) / 2];
+    p99 = result->latency_ns[((result->count - 1) * 99) / 100];
+    max = result->latency_ns[result->count - 1];
+    if(result->flash_ns != 0) {
+        snprintf(flash_ops, sizeof(flash_ops), "%.1f", (result->count * 1e9 / result->flash_ns));
+    }
+    printf("%u,%u,%s,%.2f,%u,%s,%u,%s,%.1f,%.1f,%.1f,%.1f,%.3f,%.3f,%.4f,%.1f\n",
+           config->record_size, config->tag_count, (config->skew == SKEW_ZIPF) ? "zipf" : "uniform", config->fill,
+           sector_size, op, result->count, flash_ops,
+           (result->host_ns != 0) ? (result->count * 1e9 / result->host_ns) : 0.0,
+           p50 / 1e3, p99 / 1e3, max / 1e3,
+           result->flash.read_ops / count, result->flash.program_ops / count, result->flash.erase_ops / count,
+           result->flash.program_bytes / count);
+    free(result->latency_ns);
+}
+
+#if FLASH_TLV_USE_COMPRESS
+/**
+ * @brief 生成length字节类似配置数据的文本
+ * */
+static void pack_text(uint8_t *buffer, uint16_t length, uint32_t seed) {
+    char item[64];
+    uint16_t used = 0;
+    int count;
+
+    while(used < length) {
+        count = snprintf(item, sizeof(item), BENCH_PACK_TEXT, (unsigned)(seed % 1000), (unsigned)(seed % 10));
+        seed++;
+        for(int i = 0; (i < count) && (used < length); i++) {
+            buffer[used++] = (uint8_t)item[i];
+        }
+    }
+}
+#endif
+
+/**
+ * @brief 运行一种配置：填充到目标填充率，然后依次测试追加、查询+读取、局部改写(启用增量记录时)、
+ *        压缩写入和读取(启用压缩记录时)、删除和后台整理
+ * */
+static void bench_run(const bench_config_t *config, uint32_t ops) {
+    flash_sim_t sim;
+    tlv_sector_t store;
+    tlv_block_t block;
+    bench_result_t result;
+    flash_sim_counter_t begin;
+    uint64_t flash_begin, host_begin;
+    uint8_t value[BENCH_BALLAST_SIZE];
+    uint32_t record = (TLV_MEAT_SIZE + config->record_size);
+    uint32_t workload = (record * config->tag_count);
+    uint32_t sector_size, capacity, ballast;
+    uint16_t tag;
+
+    // 扇区大小按填充率计算，对齐到4KB擦除单位
+    sector_size = (uint32_t)(workload / config->fill / (BENCH_SECTOR_COUNT - 1)) + TLV_SECTOR_HEADER_SIZE;
+    sector_size = ((sector_size + FLASH_SIM_SECTOR_SIZE - 1) / FLASH_SIM_SECTOR_SIZE) * FLASH_SIM_SECTOR_SIZE;
+    capacity = ((sector_size - TLV_SECTOR_HEADER_SIZE) * (BENCH_SECTOR_COUNT - 1));
+    ballast = (uint32_t)(capacity * config->fill);
+    ballast = (ballast > workload) ? (ballast - workload) : 0;
+
+    if(!flash_sim_create(&sim, (sector_size * BENCH_SECTOR_COUNT), NULL)) {
+        return;
+    }
+    flash_tlv_init_ring(&store, &sim.dev, 0, BENCH_SECTOR_COUNT, sector_size);
+    if(config->skew == SKEW_ZIPF) {
+        zipf_setup(config->tag_count);
+    }
+    for(uint32_t i = 0; i < sizeof(value); i++) {
+        value[i] = (uint8_t)bench_rand();
+    }
+    for(uint16_t i = 0; ballast > TLV_MEAT_SIZE; i++) {
+        uint32_t length = ballast - TLV_MEAT_SIZE;
+        length = (length > BENCH_BALLAST_SIZE) ? BENCH_BALLAST_SIZE : length;
+        flash_tlv_append(&store, (uint16_t)(BENCH_BALLAST_TAG + i), value, (uint16_t)length);
+        ballast -= (TLV_MEAT_SIZE + length);
+    }
+    for(uint16_t i = 0; i < config->tag_count; i++) {
+        flash_tlv_append(&store, i, value, config->record_size);
+    }
+
+    result_reset(&result, ops);
+    for(uint32_t i = 0; i < ops; i++) {
+        tag = next_tag(config);
+        value[0] = (uint8_t)i;
+        begin = sim.total;
+        flash_begin = sim.elapsed_ns;
+        host_begin = host_now();
+        flash_tlv_append(&store, tag, value, config->record_size);
+        result_add(&result, &sim, &begin, flash_begin, host_begin);
+    }
+    result_print(config, sector_size, "append", &result);
+
+    result_reset(&result, ops);
+    for(uint32_t i = 0; i < ops; i++) {
+        tag = next_tag(config);
+        begin = sim.total;
+        flash_begin = sim.elapsed_ns;
+        host_begin = host_now();
+        if(flash_tlv_query(&store, tag, &block)) {
+            flash_tlv_read(&store, &block, value, 0, block.length);
+        }
+        result_add(&result, &sim, &begin, flash_begin, host_begin);
+    }
+    result_print(config, sector_size, "query", &result);
+
+#if FLASH_TLV_USE_DELTA
+    // 只改写值中的BENCH_PATCH_SIZE字节，与append比较每次更新的编程字节数
+    result_reset(&result, ops);
+    for(uint32_t i = 0; i < ops; i++) {
+        tag = next_tag(config);
+        value[0] = (uint8_t)i;
+        begin = sim.total;
+        flash_begin = sim.elapsed_ns;
+        host_begin = host_now();
+        flash_tlv_patch(&store, tag, (uint16_t)((i * BENCH_PATCH_SIZE) % config->record_size), value,
+                        BENCH_PATCH_SIZE);
+        result_add(&result, &sim, &begin, flash_begin, host_begin);
+    }
+    result_print(config, sector_size, "patch", &result);
+#endif
+
+#if FLASH_TLV_USE_COMPRESS
+    // 与append写入相同大小的值，压缩后少写入的字节直接体现在编程字节数和整理擦除次数上
+    result_reset(&result, ops);
+    for(uint32_t i = 0; i < ops; i++) {
+        tag = next_tag(config);
+        pack_text(value, config->record_size, i);
+        begin = sim.total;
+        flash_begin = sim.elapsed_ns;
+        host_begin = host_now();
+        flash_tlv_append_packed(&store, tag, value, config->record_size);
+        result_add(&result, &sim, &begin, flash_begin, host_begin);
+    }
+    result_print(config, sector_size, "packed", &result);
+
+    result_reset(&result, ops);
+    for(uint32_t i = 0; i < ops; i++) {
+        tag = next_tag(config);
+        begin = sim.total;
+        flash_begin = sim.elapsed_ns;
+        host_begin = host_now();
+        if(flash_tlv_query(&store, tag, &block)) {
+            flash_tlv_read(&store, &block, value, 0, block.length);
+        }
+        result_add(&result, &sim, &begin, flash_begin, host_begin);
+    }
+    result_print(config, sector_size, "unpack", &result);
+#endif
+
+    // 每次删除前先(不计时)重新写入该tag，保证计时的是有效记录的删除而不是索引未命中
+    result_reset(&result, ops);
+    for(uint32_t i = 0; i < ops; i++) {
+        tag = next_tag(config);
+        value[0] = (uint8_t)i;
+        flash_tlv_append(&store, tag, value, config->record_size);
+        begin = sim.total;
+        flash_begin = sim.elapsed_ns;
+        host_begin = host_now();
+        if(flash_tlv_delete(&store, tag)) {
+            result_add(&result, &sim, &begin, flash_begin, host_begin);
+        }
+    }
+    result_print(config, sector_size, "delete", &result);
+
+    result_reset(&result, ops);
+    while(result.count < ops) {
+        bool pending;
+        begin = sim.total;
+        flash_begin = sim.elapsed_ns;
+        host_begin = host_now();
+        pending = flash_tlv_gc_step(&store, BENCH_GC_RECORDS);
+        // 没有需要整理的扇区时不计入样本
+        if(!pending && (sim.total.read_ops == begin.read_ops) && (sim.total.program_ops == begin.program_ops)) {
+            break;
+        }
+        result_add(&result, &sim, &begin, flash_begin, host_begin);
+        if(!pending) {
+            break;
+        }
+    }
+    result_print(config, sector_size, "gc_step", &result);
+
+    if(sim.violations != 0) {
+        fprintf(stderr, "flash violations: %u\n", sim.violations);
+    }
+    flash_sim_delete(&sim);
+}
+
+int main(int argc, char **argv) {
+    bench_config_t config;
+    uint32_t ops = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : 2000;
+
+    printf("record_size,tags,skew,fill,sector_size,op,count,flash_ops_s,host_ops_s,"
+           "p50_us,p99_us,max_us,reads_per_op,programs_per_op,erases_per_op,program_bytes_per_op\n");
+    for(uint32_t a = 0; a < sizeof(record_sizes) / sizeof(record_sizes[0]); a++) {
+        for(uint32_t b = 0; b < sizeof(tag_counts) / sizeof(tag_counts[0]); b++) {
+            for(uint32_t c = 0; c < sizeof(skews) / sizeof(skews[0]); c++) {
+                for(uint32_t d = 0; d < sizeof(fills) / sizeof(fills[0]); d++) {
+                    config.record_size = record_sizes[a];
+                    config.tag_count = tag_counts[b];
+                    config.skew = skews[c];
+                    config.fill = fills[d];
+                    bench_run(&config, ops);
+                }
+            }
+        }
+    }
+    free(zipf_cdf);
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * flash_tlv_block.h
+ * @brief 记录的Meta域格式，缓存条目直接保存tlv_block_t，不需要包含flash_tlv.h
+ * Created on: Oct 16, 2026
+ */
+
+#ifndef _FLASH_TLV_BLOCK_H_
+#define _FLASH_TLV_BLOCK_H_
+
+#include <stdint.h>
+
+#include "flash_tlv_config.h"
+
+#if FLASH_TLV_USE_CRC32
+#define TLV_MEAT_SIZE     12
+#else
+#define TLV_MEAT_SIZE     8
+#endif
+
+#define HEADER_EMPTY_TLV          0xFFFF
+#define HEADER_VALID_TLV          0xAA55
+// 批量写入的提交标记，tag为记录条数，数据域为第一条记录的地址
+#define HEADER_COMMIT_TLV         0xAA56
+// 挂载摘要，tag为索引项数，数据域为tlv_summary_t和索引项，始终按无效记录统计
+#define HEADER_SUMMARY_TLV        0xAA57
+// 流式写入的值的分段，tag为所属的标签，数据域为代号、序号和分段数据，tag自身的记录为引用分段的值头
+#define HEADER_PART_TLV           0xAA58
+// 增量记录，tag为所属的标签，数据域为链接前一条记录的头部和补丁数据，从链头回溯到完整记录得到当前的值
+#define HEADER_DELTA_TLV          0xAA59
+// 压缩记录，length为压缩后的存储长度，数据域为原始值长度和压缩数据，其余与HEADER_VALID_TLV相同
+#define HEADER_PACKED_TLV         0xAA5A
+
+#define TLV_STATE_NONE            0xFF
+#define TLV_STATE_WRITE           0xFE
+#define TLV_STATE_VERIFY          0xFC
+#define TLV_STATE_DELETE          0xF8
+
+typedef struct _tlv_block {
+    // 结构头 固定0x55 0xaa
+    uint16_t header;
+    // 结构状态
+    uint8_t status;
+    // X^8+X^2+X^1+1
+    // crc8 = calc_crc8(tag + length + entity[...])，FLASH_TLV_USE_CRC32时不使用(0xFF)
+    uint8_t crc8;
+    uint16_t tag;
+    uint16_t length;
+#if FLASH_TLV_USE_CRC32
+    // crc32 = calc_crc32c(tag + length + entity[...])
+    uint32_t crc32;
+#endif
+    // 数据域的起始地址(此参数不存储到Flash)
+    uint32_t entity;
+} tlv_block_t;
+
+#endif
@@ -1,67 +1,223 @@
 /*
  * flash_tlv_cache.c
- * @brief
+ * @brief 开放寻址(线性探测)哈希表，CLOCK淘汰
  * Created on: Apr 10, 2022
  * Author: Yanye
  */
 #include "flash_tlv_cache.h"
-#include "spi_flash.h"
 
-void invalidate_cache(cache_obj_t *obj) {
-    obj->cursor = 0;
-    memset(obj->cache, 0x00, sizeof(cache_item_t) * TLV_CACHE_MAX);
+#define CACHE_MASK    (TLV_CACHE_MAX - 1)
+
+static inline uint32_t cache_hash(uint16_t tag) {
+    // Fibonacci散列，取乘积高位
+    return ((uint16_t)(tag * 40503u)) >> (16 - TLV_CACHE_BITS);
+}
+
+/**
+ * @brief 查找tag所在槽位
+ * @return 槽位下标，不存在时返回TLV_CACHE_MAX
+ * */
+static uint32_t cache_locate(const cache_obj_t *obj, uint16_t tag) {
+    uint32_t index = cache_hash(tag);
+    while(obj->cache[index].valid) {
+        if(obj->cache[index].block.tag == tag) {
+            return index;
+        }
+        index = (index + 1) & CACHE_MASK;
+    }
+    return TLV_CACHE_MAX;
+}
+
+#if FLASH_TLV_USE_VALUE_CACHE
+static inline void value_release(cache_obj_t *obj, cache_item_t *item) {
+    if(item->value != TLV_VALUE_NONE) {
+        obj->value_used[item->value] = 0;
+        item->value = TLV_VALUE_NONE;
+    }
+}
+
+/**
+ * @brief 分配一个数据域缓存槽，没有空闲槽时按CLOCK回收未被访问项的数据域(保留其元数据)
+ * */
+static uint32_t value_alloc(cache_obj_t *obj) {
+    cache_item_t *item;
+    for(uint32_t i = 0; i < TLV_VALUE_SLOTS; i++) {
+        if(!obj->value_used[i]) {
+            obj->value_used[i] = 1;
+            return i;
+        }
+    }
+    while(1) {
+        item = &obj->cache[obj->value_hand];
+        obj->value_hand = (obj->value_hand + 1) & CACHE_MASK;
+        if(!item->valid || (item->value == TLV_VALUE_NONE)) {
+            continue;
+        }
+        if(item->referenced) {
+            item->referenced = 0;
+            continue;
+        }
+        uint32_t slot = item->value;
+        item->value = TLV_VALUE_NONE;
+        return slot;
+    }
+}
+#endif
+
+/**
+ * @brief 清除槽位，后续探测链上的项向前移动填补空位(不使用墓碑标记)
+ * */
+static void cache_erase(cache_obj_t *obj, uint32_t index) {
+    uint32_t next = index;
+    uint32_t home;
+
+#if FLASH_TLV_USE_VALUE_CACHE
+    value_release(obj, &obj->cache[index]);
+#endif
+    while(1) {
+        next = (next + 1) & CACHE_MASK;
+        if(!obj->cache[next].valid) {
+            break;
+        }
+        home = cache_hash(obj->cache[next].block.tag);
+        // home位于(index, next]区间内的项不需要移动
+        if((index <= next) ? ((index < home) && (home <= next)) : ((index < home) || (home <= next))) {
+            continue;
+        }
+        obj->cache[index] = obj->cache[next];
+        index = next;
+    }
+    obj->cache[index].valid = 0;
+    obj->count--;
 }
 
-bool get_cache(cache_obj_t *obj, uint16_t tag, tlv_block_t *blk) {
-    for(uint32_t i = 0; i < obj->cursor; i++) {
-        if(obj->cache[i].valid && (obj->cache[i].tag == tag)) {
-            if(obj->cache[i].age < CACHE_AGE_MAX) {
-                obj->cache[i].age++;
+/**
+ * @brief CLOCK淘汰，跳过并清除访问标记，直到找到未被访问过的项
+ * */
+static void cache_evict(cache_obj_t *obj) {
+    cache_item_t *item;
+    while(1) {
+        item = &obj->cache[obj->hand];
+        if(item->valid) {
+            if(!item->referenced) {
+                cache_erase(obj, obj->hand);
+                return;
             }
-            flash_read((obj->cache[i].entity - TLV_MEAT_SIZE), TLV_MEAT_SIZE, (uint8_t *)blk);
-            blk->entity = obj->cache[i].entity;
-            return true;
+            item->referenced = 0;
         }
+        obj->hand = (obj->hand + 1) & CACHE_MASK;
     }
-    return false;
 }
 
+void invalidate_cache(cache_obj_t *obj) {
+    obj->count = 0;
+    obj->hand = 0;
+    memset(obj->cache, 0x00, sizeof(cache_item_t) * TLV_CACHE_MAX);
+#if FLASH_TLV_USE_VALUE_CACHE
+    obj->value_hand = 0;
+    memset(obj->value_used, 0x00, sizeof(obj->value_used));
+#endif
+}
+
+/**
+ * @brief 查找缓存的记录块
+ * @param touch true:设置CLOCK访问标记，false:只读访问，供并发读使用
+ * */
+bool get_cache(cache_obj_t *obj, uint16_t tag, tlv_block_t *blk, bool touch) {
+    uint32_t index = cache_locate(obj, tag);
+    if(index == TLV_CACHE_MAX) {
+        return false;
+    }
+    if(touch) {
+        obj->cache[index].referenced = 1;
+    }
+    memcpy(blk, &obj->cache[index].block, sizeof(tlv_block_t));
+    return true;
+}
+
+/**
+ * @brief 加入或更新缓存
+ * @param blk 完整的记录块(Meta域和数据域地址)
+ * */
 void set_cache(cache_obj_t *obj, uint16_t tag, tlv_block_t *blk) {
-    uint32_t index;
-    uint32_t min_position = 0;
-    uint32_t age_min = obj->cache[0].age;
+    uint32_t index = cache_locate(obj, tag);
 
-    for(uint32_t i = 0; i < obj->cursor; i++) {
-        if((obj->cache[i].tag == tag) && obj->cache[i].valid) {
-            if(obj->cache[i].age < CACHE_AGE_MAX) {
-                obj->cache[i].age++;
-            }
-            obj->cache[i].entity = blk->entity;
-            return;
+    if(index == TLV_CACHE_MAX) {
+        if(obj->count >= TLV_CACHE_LIMIT) {
+            cache_evict(obj);
         }
-        if(obj->cache[i].age < age_min) {
-            age_min = obj->cache[i].age;
-            min_position = i;
+        index = cache_hash(tag);
+        while(obj->cache[index].valid) {
+            index = (index + 1) & CACHE_MASK;
         }
+        obj->cache[index].valid = 1;
+        obj->cache[index].value = TLV_VALUE_NONE;
+        obj->count++;
     }
-
-    if(obj->cursor >= TLV_CACHE_MAX) {
-        index = min_position;
-    }else {
-        index = obj->cursor;
-        obj->cursor++;
-    }
-    obj->cache[index].tag = tag;
-    obj->cache[index].age = 1;
-    obj->cache[index].valid = 1;
-    obj->cache[index].entity = blk->entity;
+#if FLASH_TLV_USE_VALUE_CACHE
+    else if(obj->cache[index].block.entity != blk->entity) {
+        // 记录已被新记录替换，旧数据域失效
+        value_release(obj, &obj->cache[index]);
+    }
+#endif
+    obj->cache[index].referenced = 1;
+    memcpy(&obj->cache[index].block, blk, sizeof(tlv_block_t));
+    obj->cache[index].block.tag = tag;
 }
 
 void remove_cache(cache_obj_t *obj, uint16_t tag) {
-    for(uint32_t i = 0; i < obj->cursor; i++) {
-        if(obj->cache[i].valid && (obj->cache[i].tag == tag)) {
-            obj->cache[i].valid = 0;
-            break;
-        }
+    uint32_t index = cache_locate(obj, tag);
+    if(index != TLV_CACHE_MAX) {
+        cache_erase(obj, index);
+    }
+}
+
+#if FLASH_TLV_USE_VALUE_CACHE
+/**
+ * @brief 从数据域缓存读取
+ * @param blk 查询得到的记录块，数据域地址需与缓存一致
+ * @param touch true:设置CLOCK访问标记，false:只读访问
+ * @return true:命中，数据已复制到buffer
+ * */
+bool get_value(cache_obj_t *obj, const tlv_block_t *blk, uint8_t *buffer, uint16_t offset, uint16_t length,
+               bool touch) {
+    uint32_t index = cache_locate(obj, blk->tag);
+    if(index == TLV_CACHE_MAX) {
+        return false;
+    }
+    cache_item_t *item = &obj->cache[index];
+    if((item->value == TLV_VALUE_NONE) || (item->block.entity != blk->entity)) {
+        return false;
+    }
+    if(touch) {
+        item->referenced = 1;
+    }
+    memcpy(buffer, &obj->values[item->value][offset], length);
+    return true;
+}
+
+/**
+ * @brief 保存记录的数据域，记录的元数据需要已在缓存中
+ * @param blk 记录块，blk->length不超过TLV_VALUE_ITEM_MAX
+ * @param data 完整的数据域
+ * @return true:已缓存
+ * */
+bool set_value(cache_obj_t *obj, const tlv_block_t *blk, const uint8_t *data) {
+    if(blk->length > TLV_VALUE_ITEM_MAX) {
+        return false;
+    }
+    uint32_t index = cache_locate(obj, blk->tag);
+    if(index == TLV_CACHE_MAX) {
+        return false;
+    }
+    cache_item_t *item = &obj->cache[index];
+    if(item->block.entity != blk->entity) {
+        return false;
+    }
+    if(item->value == TLV_VALUE_NONE) {
+        item->value = value_alloc(obj);
     }
+    memcpy(obj->values[item->value], data, blk->length);
+    return true;
 }
+#endif
@@ -12,29 +12,59 @@
 #include <string.h>
 #include <stdbool.h>
 
-#include "flash_tlv.h"
+#include "flash_tlv_block.h"
 
-#define CACHE_AGE_MAX    0xFF
-#define TLV_CACHE_MAX    16
+// 哈希表槽位数 = 2^TLV_CACHE_BITS
+#define TLV_CACHE_BITS    5
+#define TLV_CACHE_MAX     (1 << TLV_CACHE_BITS)
+// 最多缓存的记录数，保留1/4空槽使线性探测保持较短
+#define TLV_CACHE_LIMIT   ((TLV_CACHE_MAX * 3) / 4)
+
+#if FLASH_TLV_USE_VALUE_CACHE
+// 数据域缓存总字节数
+#define TLV_VALUE_CACHE_SIZE    512
+// 可缓存的最大数据域长度，也是每个缓存槽的大小
+#define TLV_VALUE_ITEM_MAX      32
+#define TLV_VALUE_SLOTS         (TLV_VALUE_CACHE_SIZE / TLV_VALUE_ITEM_MAX)
+#endif
+#define TLV_VALUE_NONE          0xFFFF
 
 typedef struct _cache_item {
     uint8_t valid;
-    uint8_t age;
-    uint16_t tag;
-    uint32_t entity;
+    // CLOCK淘汰算法的访问标记
+    uint8_t referenced;
+    // 数据域缓存槽下标，TLV_VALUE_NONE表示数据域未缓存
+    uint16_t value;
+    // 完整的Meta域和数据域地址，命中时不需要读Flash
+    tlv_block_t block;
 }cache_item_t;
 
 typedef struct _cache_obj {
-    uint32_t cursor;
+    uint16_t count;
+    // CLOCK指针
+    uint16_t hand;
     cache_item_t cache[TLV_CACHE_MAX];
+#if FLASH_TLV_USE_VALUE_CACHE
+    // 数据域缓存槽的CLOCK指针(指向cache[])
+    uint16_t value_hand;
+    uint8_t value_used[TLV_VALUE_SLOTS];
+    uint8_t values[TLV_VALUE_SLOTS][TLV_VALUE_ITEM_MAX];
+#endif
 }cache_obj_t;
 
 void invalidate_cache(cache_obj_t *obj);
 
-bool get_cache(cache_obj_t *obj, uint16_t tag, tlv_block_t *blk);
+bool get_cache(cache_obj_t *obj, uint16_t tag, tlv_block_t *blk, bool touch);
 
 void set_cache(cache_obj_t *obj, uint16_t tag, tlv_block_t *blk);
 
 void remove_cache(cache_obj_t *obj, uint16_t tag);
 
+#if FLASH_TLV_USE_VALUE_CACHE
+bool get_value(cache_obj_t *obj, const tlv_block_t *blk, uint8_t *buffer, uint16_t offset, uint16_t length,
+               bool touch);
+
+bool set_value(cache_obj_t *obj, const tlv_block_t *blk, const uint8_t *data);
+#endif
+
 #endif
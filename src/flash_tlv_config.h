@@ -0,0 +1,51 @@
+/*
+ * flash_tlv_config.h
+ * @brief 功能开关，flash_tlv.h和依赖记录类型的头文件共同包含
+ * Created on: Oct 16, 2026
+ */
+
+#ifndef _FLASH_TLV_CONFIG_H_
+#define _FLASH_TLV_CONFIG_H_
+
+#define FLASH_TLV_DEBUG        0
+#define FLASH_TLV_USE_CACHE    1
+#define FLASH_TLV_USE_INDEX    1
+// 缓存小记录的数据域，依赖FLASH_TLV_USE_CACHE
+#define FLASH_TLV_USE_VALUE_CACHE    1
+// 运行统计: Flash访问、缓存命中、GC次数和耗时
+#define FLASH_TLV_USE_STATS    1
+// 读写锁钩子，多个任务访问同一存储时查询/读取之间并发，追加/删除/整理独占
+#define FLASH_TLV_USE_LOCK     1
+// 记录使用CRC32C校验(Meta域扩展为12字节)，关闭时使用CRC8，两种格式的Flash镜像不兼容
+#define FLASH_TLV_USE_CRC32    0
+// 冷热分离: 连续多次整理期间没有更新的记录移到冷区，热区整理不再复制它们，依赖FLASH_TLV_USE_INDEX
+#define FLASH_TLV_USE_COLD     1
+// 挂载摘要: 整理完成和启用新扇区时写入索引快照，挂载时只需要重放工作扇区，依赖FLASH_TLV_USE_INDEX
+// 摘要记录占用工作扇区空间(16 + 8 * 索引项数 bytes)，未启用时摘要记录按无效记录跳过
+#ifndef FLASH_TLV_USE_SUMMARY
+#define FLASH_TLV_USE_SUMMARY  0
+#endif
+// 流式读写: 超过RAM缓冲区的值分多次写入/读取，拆分为多条分段记录存储，可以跨越多个扇区
+#define FLASH_TLV_USE_STREAM   1
+// 增量记录: 只改写值的一部分或在值末尾追加时只写入变化的字节，读取时合并，整理时折叠为完整记录，依赖FLASH_TLV_USE_INDEX
+#define FLASH_TLV_USE_DELTA    1
+// 压缩记录: flash_tlv_append_packed写入的值经LZSS压缩后存储，读取时用固定大小的窗口流式解压
+#define FLASH_TLV_USE_COMPRESS 1
+
+#if FLASH_TLV_USE_VALUE_CACHE && !FLASH_TLV_USE_CACHE
+#error "FLASH_TLV_USE_VALUE_CACHE requires FLASH_TLV_USE_CACHE"
+#endif
+
+#if FLASH_TLV_USE_COLD && !FLASH_TLV_USE_INDEX
+#error "FLASH_TLV_USE_COLD requires FLASH_TLV_USE_INDEX"
+#endif
+
+#if FLASH_TLV_USE_SUMMARY && !FLASH_TLV_USE_INDEX
+#error "FLASH_TLV_USE_SUMMARY requires FLASH_TLV_USE_INDEX"
+#endif
+
+#if FLASH_TLV_USE_DELTA && !FLASH_TLV_USE_INDEX
+#error "FLASH_TLV_USE_DELTA requires FLASH_TLV_USE_INDEX"
+#endif
+
+#endif
@@ -0,0 +1,360 @@
+/*
+ * flash_tlv_image.c
+ * @brief 主机端镜像工具: 按清单生成可直接烧录的FlashTLV分区镜像，或解析导出已有镜像中的有效记录
+ * @note 用法: flash_tlv_image build <清单> <镜像> [扇区大小，默认4096] [扇区数量，默认2]
+ *             flash_tlv_image dump <镜像> [扇区大小，默认4096] [扇区数量，默认2]
+ *       清单每行一条记录: <tag> <值>，tag为十进制或0x开头的十六进制，值为十六进制字节串或@文件路径，
+ *       '#'开头的行为注释；同一tag出现多次时最后一行生效。dump的输出格式与清单相同，可以直接作为清单使用。
+ *       镜像按扇区大小和数量布局，与设备端flash_tlv_init_ring(base, count, size)对应，记录格式由flash_tlv.h的开关决定
+ * Created on: Oct 16, 2026
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "flash_tlv.h"
+
+#define IMAGE_SECTOR_SIZE     4096
+#define IMAGE_SECTOR_COUNT    2
+// 清单单行最大长度，能容纳一个最大记录的十六进制值
+#define IMAGE_LINE_MAX        (2 * 0xFFFF + 64)
+
+typedef struct _image_entry {
+    uint16_t tag;
+    uint16_t length;
+    uint8_t *data;
+    // 清单中的行号，tag相同时行号大的生效
+    uint32_t line;
+} image_entry_t;
+
+typedef struct _image_list {
+    image_entry_t *entries;
+    uint32_t count;
+    uint32_t capacity;
+} image_list_t;
+
+/**
+ * @brief 镜像内存后端，不输出操作日志，dump的标准输出只包含记录
+ * */
+static void image_read(flash_dev_t *dev, uint32_t addr, uint32_t length, uint8_t *buffer) {
+    memcpy(buffer, ((uint8_t *)dev->context + addr), length);
+}
+
+static void image_write(flash_dev_t *dev, uint32_t addr, uint32_t length, const uint8_t *buffer) {
+    uint8_t *mem = ((uint8_t *)dev->context + addr);
+    for(uint32_t i = 0; i < length; i++) {
+        mem[i] &= buffer[i];
+    }
+}
+
+static void image_erase(flash_dev_t *dev, uint32_t addr, uint32_t size) {
+    memset(((uint8_t *)dev->context + addr), 0xFF, size);
+}
+
+static const uint8_t *image_pointer(flash_dev_t *dev, uint32_t addr) {
+    return ((const uint8_t *)dev->context + addr);
+}
+
+static void image_create(flash_dev_t *dev, uint32_t size) {
+    dev->read = image_read;
+    dev->write = image_write;
+    dev->erase = image_erase;
+    dev->pointer = image_pointer;
+    dev->clock = NULL;
+    dev->context = malloc(size);
+    dev->size = size;
+    memset(dev->context, 0xFF, size);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: flash_tlv_image build <manifest> <image> [sector_size] [sector_count]\n"
+                    "       flash_tlv_image dump <image> [sector_size] [sector_count]\n");
+}
+
+static int hex_digit(char c) {
+    if((c >= '0') && (c <= '9')) {
+        return (c - '0');
+    }
+    c = (char)tolower((unsigned char)c);
+    if((c >= 'a') && (c <= 'f')) {
+        return (c - 'a' + 10);
+    }
+    return -1;
+}
+
+/**
+ * @brief 解析十六进制字节串，允许0x前缀
+ * @return true:解析成功，entry的data和length有效
+ * */
+static bool parse_hex(const char *text, image_entry_t *entry) {
+    size_t count;
+    int high, low;
+
+    if((text[0] == '0') && ((text[1] == 'x') || (text[1] == 'X'))) {
+        text += 2;
+    }
+    count = strlen(text);
+    if(((count % 2) != 0) || ((count / 2) > 0xFFFF)) {
+        return false;
+    }
+    entry->length = (uint16_t)(count / 2);
+    entry->data = malloc(entry->length + 1);
+    for(uint32_t i = 0; i < entry->length; i++) {
+        high = hex_digit(text[2 * i]);
+        low = hex_digit(text[2 * i + 1]);
+        if((high < 0) || (low < 0)) {
+            free(entry->data);
+            return false;
+        }
+        entry->data[i] = (uint8_t)((high << 4) | low);
+    }
+    return true;
+}
+
+/**
+ * @brief 读取整个文件作为记录的值
+ * @return true:读取成功，entry的data和length有效
+ * */
+static bool load_file(const char *filepath, image_entry_t *entry) {
+    FILE *file = fopen(filepath, "rb");
+    long size;
+
+    if(file == NULL) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if((size < 0) || (size > 0xFFFF)) {
+        fclose(file);
+        return false;
+    }
+    entry->length = (uint16_t)size;
+    entry->data = malloc(entry->length + 1);
+    if(fread(entry->data, 1, entry->length, file) != entry->length) {
+        free(entry->data);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+    return true;
+}
+
+/**
+ * @brief 解析清单，每条记录的值读入内存
+ * @return true:清单全部解析成功
+ * */
+static bool load_manifest(const char *filepath, image_list_t *list) {
+    FILE *file = fopen(filepath, "r");
+    char *line, *tag, *value, *end;
+    image_entry_t entry;
+    uint32_t number = 0;
+    unsigned long parsed;
+    bool res = true;
+
+    if(file == NULL) {
+        fprintf(stderr, "cannot open manifest: %s\n", filepath);
+        return false;
+    }
+    line = malloc(IMAGE_LINE_MAX);
+    while(fgets(line, IMAGE_LINE_MAX, file) != NULL) {
+        number++;
+        tag = strtok(line, " \t\r\n");
+        if((tag == NULL) || (tag[0] == '#')) {
+            continue;
+        }
+        value = strtok(NULL, " \t\r\n");
+        parsed = strtoul(tag, &end, 0);
+        if((*end != '\0') || (parsed > 0xFFFF) || (value == NULL)) {
+            fprintf(stderr, "%s:%u: expected '<tag> <hex value | @file>'\n", filepath, number);
+            res = false;
+            break;
+        }
+        entry.tag = (uint16_t)parsed;
+        entry.line = number;
+        if(!((value[0] == '@') ? load_file((value + 1), &entry) : parse_hex(value, &entry))) {
+            fprintf(stderr, "%s:%u: invalid value '%s'\n", filepath, number, value);
+            res = false;
+            break;
+        }
+        if(list->count == list->capacity) {
+            list->capacity = (list->capacity == 0) ? 64 : (list->capacity * 2);
+            list->entries = realloc(list->entries, (sizeof(image_entry_t) * list->capacity));
+        }
+        list->entries[list->count++] = entry;
+    }
+    free(line);
+    fclose(file);
+    return res;
+}
+
+static int compare_entry(const void *a, const void *b) {
+    const image_entry_t *x = (const image_entry_t *)a;
+    const image_entry_t *y = (const image_entry_t *)b;
+
+    if(x->tag != y->tag) {
+        return (x->tag < y->tag) ? -1 : 1;
+    }
+    return (x->line < y->line) ? -1 : 1;
+}
+
+/**
+ * @brief 按tag排序并去重，tag相同时只保留清单中最后出现的一条，镜像中不产生无效记录
+ * */
+static void compact_list(image_list_t *list) {
+    uint32_t count = 0;
+
+    qsort(list->entries, list->count, sizeof(image_entry_t), compare_entry);
+    for(uint32_t i = 0; i < list->count; i++) {
+        if(((i + 1) < list->count) && (list->entries[i + 1].tag == list->entries[i].tag)) {
+            free(list->entries[i].data);
+            continue;
+        }
+        list->entries[count++] = list->entries[i];
+    }
+    list->count = count;
+}
+
+static void free_list(image_list_t *list) {
+    for(uint32_t i = 0; i < list->count; i++) {
+        free(list->entries[i].data);
+    }
+    free(list->entries);
+}
+
+/**
+ * @brief 在RAM中格式化分区并按tag顺序写入全部记录，重新挂载逐条校验后导出镜像
+ * @note 主机RAM写入可靠，写入时不回读校验(TLV_VERIFY_NONE)，全部写入后统一按CRC校验一遍
+ * */
+static int image_build(const char *manifest, const char *output, uint32_t size, uint16_t count) {
+    image_list_t list = {NULL, 0, 0};
+    flash_dev_t dev;
+    tlv_sector_t sector;
+    tlv_block_t block;
+    FILE *file = NULL;
+    uint32_t bytes = 0;
+    int res = 1;
+
+    if(!load_manifest(manifest, &list)) {
+        free_list(&list);
+        return 1;
+    }
+    compact_list(&list);
+
+    image_create(&dev, (size * count));
+    flash_tlv_init_ring(&sector, &dev, 0, count, size);
+    flash_tlv_set_verify(&sector, TLV_VERIFY_NONE);
+    flash_tlv_format(&sector);
+    for(uint32_t i = 0; i < list.count; i++) {
+        if(!flash_tlv_append(&sector, list.entries[i].tag, list.entries[i].data, list.entries[i].length)) {
+            fprintf(stderr, "no space for tag 0x%04x (%u bytes), %u of %u records written\n",
+                    list.entries[i].tag, list.entries[i].length, i, list.count);
+            goto LAB_EXIT;
+        }
+        bytes += (TLV_MEAT_SIZE + list.entries[i].length);
+    }
+    // 按设备首次上电的方式重新挂载，确认每条记录都能查询到且校验通过
+    flash_tlv_init_ring(&sector, &dev, 0, count, size);
+    for(uint32_t i = 0; i < list.count; i++) {
+        if(!flash_tlv_query(&sector, list.entries[i].tag, &block) || (block.length != list.entries[i].length) ||
+           !flash_tlv_verify(&sector, &block)) {
+            fprintf(stderr, "verify failed at tag 0x%04x\n", list.entries[i].tag);
+            goto LAB_EXIT;
+        }
+    }
+    file = fopen(output, "wb");
+    if((file == NULL) || (fwrite(dev.context, 1, dev.size, file) != dev.size)) {
+        fprintf(stderr, "cannot write image: %s\n", output);
+    }else {
+        printf("image: %u records, %u bytes used of %u\n", list.count, bytes, dev.size);
+        res = 0;
+    }
+    if(file != NULL) {
+        fclose(file);
+    }
+
+    LAB_EXIT:
+    free(dev.context);
+    free_list(&list);
+    return res;
+}
+
+static bool print_record(const tlv_block_t *block, const uint8_t *data, void *context) {
+    FILE *out = (FILE *)context;
+
+    fprintf(out, "0x%04x ", block->tag);
+    for(uint32_t i = 0; i < block->length; i++) {
+        fprintf(out, "%02x", data[i]);
+    }
+    fprintf(out, "\n");
+    return true;
+}
+
+/**
+ * @brief 读入镜像并输出全部有效记录，输出格式与清单相同
+ * @note 镜像小于分区大小时缺少的部分按擦除状态处理；没有有效扇区头时不挂载(挂载会格式化存储)，直接报错
+ * */
+static int image_dump(const char *input, uint32_t size, uint16_t count) {
+    flash_dev_t dev;
+    tlv_sector_t sector;
+    tlv_sector_header_t header;
+    uint8_t *buffer;
+    uint32_t records;
+    bool valid = false;
+    FILE *file = fopen(input, "rb");
+
+    if(file == NULL) {
+        fprintf(stderr, "cannot open image: %s\n", input);
+        return 1;
+    }
+    image_create(&dev, (size * count));
+    fread(dev.context, 1, dev.size, file);
+    fclose(file);
+    for(uint16_t i = 0; i < count; i++) {
+        dev.read(&dev, (i * size), sizeof(header), (uint8_t *)&header);
+        valid |= (header.tag == TLV_SECTOR_TAG);
+    }
+    if(!valid) {
+        fprintf(stderr, "no valid sector header in %s\n", input);
+        free(dev.context);
+        return 1;
+    }
+    buffer = malloc(size);
+    flash_tlv_init_ring(&sector, &dev, 0, count, size);
+    records = flash_tlv_foreach(&sector, 0x0000, 0xFFFF, buffer, (uint16_t)((size > 0xFFFF) ? 0xFFFF : size),
+                                print_record, stdout);
+    fprintf(stderr, "image: %u records\n", records);
+    free(buffer);
+    free(dev.context);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    uint32_t size = IMAGE_SECTOR_SIZE;
+    uint16_t count = IMAGE_SECTOR_COUNT;
+    int geometry;
+
+    if((argc >= 4) && (strcmp(argv[1], "build") == 0)) {
+        geometry = 4;
+    }else if((argc >= 3) && (strcmp(argv[1], "dump") == 0)) {
+        geometry = 3;
+    }else {
+        usage();
+        return 2;
+    }
+    if(argc > geometry) {
+        size = (uint32_t)strtoul(argv[geometry], NULL, 0);
+    }
+    if(argc > (geometry + 1)) {
+        count = (uint16_t)strtoul(argv[geometry + 1], NULL, 0);
+    }
+    if((size <= TLV_SECTOR_HEADER_SIZE) || (count < 2) || (count > TLV_SECTOR_MAX)) {
+        fprintf(stderr, "invalid geometry: sector_size %u, sector_count %u\n", size, count);
+        return 2;
+    }
+    if(geometry == 4) {
+        return image_build(argv[2], argv[3], size, count);
+    }
+    return image_dump(argv[2], size, count);
+}
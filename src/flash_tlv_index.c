@@ -0,0 +1,121 @@
+/*
+ * flash_tlv_index.c
+ * @brief
+ * Created on: Oct 16, 2026
+ */
+#include "flash_tlv_index.h"
+
+/**
+ * @brief 二分查找tag所在位置
+ * @param position 找到时为tag的下标，未找到时为插入位置
+ * @return true:找到
+ * */
+static bool index_locate(const index_obj_t *obj, uint16_t tag, uint32_t *position) {
+    uint32_t low = 0;
+    uint32_t high = obj->count;
+    uint32_t middle;
+
+    while(low < high) {
+        middle = (low + high) >> 1;
+        if(obj->items[middle].tag < tag) {
+            low = middle + 1;
+        }else {
+            high = middle;
+        }
+    }
+    *position = low;
+    return (low < obj->count) && (obj->items[low].tag == tag);
+}
+
+void index_reset(index_obj_t *obj) {
+    obj->count = 0;
+    obj->complete = 1;
+}
+
+/**
+ * @return tag对应的索引项，不存在时返回NULL
+ * */
+const index_item_t *index_find(const index_obj_t *obj, uint16_t tag) {
+    uint32_t position;
+    if(!index_locate(obj, tag, &position)) {
+        return NULL;
+    }
+    return &obj->items[position];
+}
+
+/**
+ * @brief 插入或更新tag对应的地址
+ * @note 索引已满时新tag不会被插入，索引标记为不完整；新插入的tag热度为1，更新地址不改变热度
+ * @return true:索引中已记录该tag
+ * */
+bool index_update(index_obj_t *obj, uint16_t tag, uint32_t address, uint16_t length) {
+    uint32_t position;
+    if(index_locate(obj, tag, &position)) {
+        obj->items[position].length = length;
+        obj->items[position].address = address;
+        return true;
+    }
+    if(obj->count >= TLV_INDEX_MAX) {
+        obj->complete = 0;
+        return false;
+    }
+    memmove(&obj->items[position + 1], &obj->items[position],
+            sizeof(index_item_t) * (obj->count - position));
+    memmove(&obj->heat[position + 1], &obj->heat[position], (obj->count - position));
+    obj->heat[position] = 1;
+    obj->items[position].tag = tag;
+    obj->items[position].length = length;
+    obj->items[position].address = address;
+    obj->count++;
+    return true;
+}
+
+void index_remove(index_obj_t *obj, uint16_t tag) {
+    uint32_t position;
+    if(!index_locate(obj, tag, &position)) {
+        return;
+    }
+    obj->count--;
+    memmove(&obj->items[position], &obj->items[position + 1],
+            sizeof(index_item_t) * (obj->count - position));
+    memmove(&obj->heat[position], &obj->heat[position + 1], (obj->count - position));
+}
+
+/**
+ * @brief 使用已按tag升序填入items的count个索引项，索引视为完整，热度与新插入的tag相同
+ * */
+void index_restore(index_obj_t *obj, uint16_t count) {
+    obj->count = (count > TLV_INDEX_MAX) ? TLV_INDEX_MAX : count;
+    obj->complete = 1;
+    memset(obj->heat, 1, sizeof(obj->heat));
+}
+
+/**
+ * @brief 记录一次tag更新，热度加1
+ * */
+void index_touch(index_obj_t *obj, uint16_t tag) {
+    uint32_t position;
+    if(index_locate(obj, tag, &position) && (obj->heat[position] < TLV_HEAT_MAX)) {
+        obj->heat[position]++;
+    }
+}
+
+/**
+ * @brief 所有tag热度减半，连续多次整理期间没有更新的tag热度降为0
+ * */
+void index_cool(index_obj_t *obj) {
+    for(uint32_t i = 0; i < obj->count; i++) {
+        obj->heat[i] >>= 1;
+    }
+}
+
+/**
+ * @return tag的热度，不在索引中时返回TLV_HEAT_MAX(按热数据处理)
+ * */
+uint8_t index_heat(const index_obj_t *obj, uint16_t tag) {
+    uint32_t position;
+    if(!index_locate(obj, tag, &position)) {
+        return TLV_HEAT_MAX;
+    }
+    return obj->heat[position];
+}
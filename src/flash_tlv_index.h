@@ -0,0 +1,52 @@
+/*
+ * flash_tlv_index.h
+ * @brief 标签索引, tag->记录地址, 按tag升序排列, 二分查找
+ * Created on: Oct 16, 2026
+ */
+
+#ifndef _FLASH_TLV_INDEX_H_
+#define _FLASH_TLV_INDEX_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+// 索引容量, 每项占用9字节RAM(索引项8字节 + 热度1字节)
+#define TLV_INDEX_MAX    64
+// 热度上限, 每次更新加1, 每完成一次扇区整理减半
+#define TLV_HEAT_MAX     0xFF
+
+typedef struct _index_item {
+    uint16_t tag;
+    // 记录数据域长度
+    uint16_t length;
+    // 记录Meta域的起始地址
+    uint32_t address;
+}index_item_t;
+
+typedef struct _index_obj {
+    uint16_t count;
+    // 1:索引包含全部有效记录, 0:索引溢出过, 未命中时仍需扫描扇区
+    uint16_t complete;
+    index_item_t items[TLV_INDEX_MAX];
+    // 与items一一对应的更新热度, 用于冷热分离
+    uint8_t heat[TLV_INDEX_MAX];
+}index_obj_t;
+
+void index_reset(index_obj_t *obj);
+
+const index_item_t *index_find(const index_obj_t *obj, uint16_t tag);
+
+bool index_update(index_obj_t *obj, uint16_t tag, uint32_t address, uint16_t length);
+
+void index_remove(index_obj_t *obj, uint16_t tag);
+
+void index_restore(index_obj_t *obj, uint16_t count);
+
+void index_touch(index_obj_t *obj, uint16_t tag);
+
+void index_cool(index_obj_t *obj);
+
+uint8_t index_heat(const index_obj_t *obj, uint16_t tag);
+
+#endif
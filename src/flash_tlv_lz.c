@@ -0,0 +1,168 @@
+/*
+ * flash_tlv_lz.c
+ * @brief LZSS压缩和流式解压，压缩记录使用
+ * Created on: Oct 16, 2026
+ */
+#include "flash_tlv_lz.h"
+
+/**
+ * @brief 解压时的输入缓冲
+ * */
+typedef struct _lz_reader {
+    lz_input_t input;
+    void *context;
+    // 压缩数据总长度和下一次读取的偏移
+    uint32_t size;
+    uint32_t offset;
+    // 缓冲区中的字节数和已取出的字节数
+    uint16_t count;
+    uint16_t position;
+    uint8_t buffer[LZ_INPUT_SIZE];
+} lz_reader_t;
+
+/**
+ * @brief 在窗口内查找与data[position]开始的内容最长的匹配
+ * @param distance 输出匹配的距离
+ * @return 匹配长度，小于LZ_MATCH_MIN时不使用
+ * */
+static uint32_t lz_match(const uint8_t *data, uint32_t length, uint32_t position, uint32_t *distance) {
+    uint32_t best = 0, count;
+    uint32_t limit = (length - position);
+    uint32_t window = (position > LZ_WINDOW_SIZE) ? LZ_WINDOW_SIZE : position;
+
+    limit = (limit > LZ_MATCH_MAX) ? LZ_MATCH_MAX : limit;
+    if(limit < LZ_MATCH_MIN) {
+        return 0;
+    }
+    for(uint32_t back = 1; back <= window; back++) {
+        // 允许与待压缩内容重叠，解压时逐字节复制
+        for(count = 0; (count < limit) && (data[position - back + count] == data[position + count]); count++);
+        if(count > best) {
+            best = count;
+            *distance = back;
+            if(best == limit) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief 压缩data，按组调用output输出
+ * @param output 为NULL时只计算压缩后的长度
+ * @return 压缩后的长度(bytes)
+ * */
+uint32_t lz_compress(const uint8_t *data, uint32_t length, lz_output_t output, void *context) {
+    // 标志字节 + 8项，每项最多2字节
+    uint8_t group[1 + (8 * 2)];
+    uint32_t used = 1, total = 0, position = 0;
+    uint32_t count, distance = 0;
+    uint8_t bit = 0;
+
+    group[0] = 0;
+    while(position < length) {
+        count = lz_match(data, length, position, &distance);
+        if(count >= LZ_MATCH_MIN) {
+            group[0] |= (uint8_t)(1 << bit);
+            group[used++] = (uint8_t)(distance - 1);
+            group[used++] = (uint8_t)(count - LZ_MATCH_MIN);
+            position += count;
+        }else {
+            group[used++] = data[position++];
+        }
+        if(++bit == 8) {
+            if(output != NULL) {
+                output(context, group, used);
+            }
+            total += used;
+            used = 1;
+            bit = 0;
+            group[0] = 0;
+        }
+    }
+    if(bit != 0) {
+        if(output != NULL) {
+            output(context, group, used);
+        }
+        total += used;
+    }
+    return total;
+}
+
+/**
+ * @brief 取出下一个压缩字节，缓冲区取空时读取下一段
+ * @return false:压缩数据已结束
+ * */
+static bool lz_next(lz_reader_t *reader, uint8_t *byte) {
+    uint32_t trunk;
+
+    if(reader->position == reader->count) {
+        if(reader->offset >= reader->size) {
+            return false;
+        }
+        trunk = (reader->size - reader->offset);
+        trunk = (trunk > LZ_INPUT_SIZE) ? LZ_INPUT_SIZE : trunk;
+        reader->input(reader->context, reader->offset, reader->buffer, trunk);
+        reader->offset += trunk;
+        reader->count = (uint16_t)trunk;
+        reader->position = 0;
+    }
+    *byte = reader->buffer[reader->position++];
+    return true;
+}
+
+/**
+ * @brief 从头解压size字节的压缩数据，只把原始值中[offset, offset + length)复制到buffer
+ * @note 之前的内容只保留在窗口中，不需要整个值大小的RAM；输出到offset + length即停止
+ * @return false:压缩数据不完整或距离超出已输出的内容
+ * */
+bool lz_decompress(lz_input_t input, void *context, uint32_t size, uint8_t *buffer, uint32_t offset,
+                   uint32_t length) {
+    lz_reader_t reader;
+    uint8_t window[LZ_WINDOW_SIZE];
+    uint32_t output = 0, end = (offset + length);
+    uint32_t distance, count;
+    uint8_t flags, byte, value;
+
+    reader.input = input;
+    reader.context = context;
+    reader.size = size;
+    reader.offset = 0;
+    reader.count = 0;
+    reader.position = 0;
+    while(output < end) {
+        if(!lz_next(&reader, &flags)) {
+            return false;
+        }
+        for(uint8_t bit = 0; (bit < 8) && (output < end); bit++) {
+            if(!lz_next(&reader, &byte)) {
+                return false;
+            }
+            count = 1;
+            distance = 0;
+            if(flags & (1 << bit)) {
+                if(!lz_next(&reader, &value)) {
+                    return false;
+                }
+                distance = ((uint32_t)byte + 1);
+                count = ((uint32_t)value + LZ_MATCH_MIN);
+                if(distance > output) {
+                    return false;
+                }
+            }
+            while((count != 0) && (output < end)) {
+                if(distance != 0) {
+                    byte = window[(output - distance) % LZ_WINDOW_SIZE];
+                }
+                window[output % LZ_WINDOW_SIZE] = byte;
+                if(output >= offset) {
+                    buffer[output - offset] = byte;
+                }
+                output++;
+                count--;
+            }
+        }
+    }
+    return true;
+}
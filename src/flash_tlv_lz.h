@@ -0,0 +1,39 @@
+/*
+ * flash_tlv_lz.h
+ * @brief LZSS压缩, 固定256字节窗口, 解压只需要窗口大小的RAM, 可以从任意偏移开始输出
+ * @note 格式: 每组以1字节标志开头, 之后最多8项, 标志位(低位在前)为0时该项是1字节原文,
+ *       为1时是2字节匹配(距离 - 1, 长度 - LZ_MATCH_MIN), 从已输出内容的末尾向前复制
+ * Created on: Oct 16, 2026
+ */
+
+#ifndef _FLASH_TLV_LZ_H_
+#define _FLASH_TLV_LZ_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// 匹配窗口大小, 距离用1字节存储, 不能超过256
+#define LZ_WINDOW_SIZE    256
+// 最短匹配长度, 更短的重复按原文存储
+#define LZ_MATCH_MIN      3
+#define LZ_MATCH_MAX      (LZ_MATCH_MIN + 0xFF)
+// 解压时每次读取的压缩数据字节数, 占用等大的栈空间
+#define LZ_INPUT_SIZE     32
+
+/**
+ * @brief 压缩输出回调, 每组数据输出一次
+ * */
+typedef void (*lz_output_t)(void *context, const uint8_t *data, uint32_t length);
+
+/**
+ * @brief 解压输入回调, 读取压缩数据中[offset, offset + length)
+ * */
+typedef void (*lz_input_t)(void *context, uint32_t offset, uint8_t *buffer, uint32_t length);
+
+uint32_t lz_compress(const uint8_t *data, uint32_t length, lz_output_t output, void *context);
+
+bool lz_decompress(lz_input_t input, void *context, uint32_t size, uint8_t *buffer, uint32_t offset,
+                   uint32_t length);
+
+#endif
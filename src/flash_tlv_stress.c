@@ -0,0 +1,250 @@
+/*
+ * flash_tlv_stress.c
+ * @brief 并发压力测试，1个写线程持续追加，N个读线程并发查询读取，
+ *        分别使用互斥锁和读写锁钩子，每种组合输出一行CSV: 读/写吞吐和数据不一致次数
+ * @note 用法: flash_tlv_stress [每种组合运行时间ms，默认500]
+ *       后端每次读取休眠STRESS_READ_US，模拟任务等待SPI/DMA传输完成，单核机器上也能体现读操作之间的并发
+ * Created on: Oct 16, 2026
+ */
+// pthread_rwlockattr_setkind_np
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "flash_tlv.h"
+
+#define STRESS_SECTOR_COUNT    4
+#define STRESS_SECTOR_SIZE     0x4000
+#define STRESS_TAGS            64
+#define STRESS_VALUE_SIZE      64
+// 每次Flash读取的等待时间(us)
+#define STRESS_READ_US         20
+// 写线程两次追加之间的间隔(us)
+#define STRESS_WRITE_GAP_US    500
+#define STRESS_READERS_MAX     8
+
+#if !FLASH_TLV_USE_LOCK
+#error "flash_tlv_stress requires FLASH_TLV_USE_LOCK"
+#endif
+
+typedef enum {
+    LOCK_MUTEX = 0,
+    LOCK_RWLOCK,
+} stress_lock_t;
+
+typedef struct _stress_state {
+    tlv_sector_t store;
+    pthread_mutex_t mutex;
+    pthread_rwlock_t rwlock;
+    volatile int running;
+    uint32_t read_ops[STRESS_READERS_MAX];
+    uint32_t mismatches[STRESS_READERS_MAX];
+    uint32_t write_ops;
+} stress_state_t;
+
+static const uint16_t reader_counts[] = {1, 2, 4, 8};
+
+static void sleep_us(uint32_t us) {
+    struct timespec ts = {.tv_sec = (us / 1000000), .tv_nsec = (long)(us % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+static void bus_read(flash_dev_t *dev, uint32_t addr, uint32_t length, uint8_t *buffer) {
+    memcpy(buffer, ((uint8_t *)dev->context + addr), length);
+    sleep_us(STRESS_READ_US);
+}
+
+static void bus_write(flash_dev_t *dev, uint32_t addr, uint32_t length, const uint8_t *buffer) {
+    uint8_t *mem = ((uint8_t *)dev->context + addr);
+    for(uint32_t i = 0; i < length; i++) {
+        mem[i] &= buffer[i];
+    }
+}
+
+static void bus_erase(flash_dev_t *dev, uint32_t addr, uint32_t size) {
+    memset(((uint8_t *)dev->context + addr), 0xFF, size);
+}
+
+static void mutex_lock(void *context) {
+    pthread_mutex_lock(&((stress_state_t *)context)->mutex);
+}
+
+static void mutex_unlock(void *context) {
+    pthread_mutex_unlock(&((stress_state_t *)context)->mutex);
+}
+
+static void rwlock_read(void *context) {
+    pthread_rwlock_rdlock(&((stress_state_t *)context)->rwlock);
+}
+
+static void rwlock_write(void *context) {
+    pthread_rwlock_wrlock(&((stress_state_t *)context)->rwlock);
+}
+
+static void rwlock_unlock(void *context) {
+    pthread_rwlock_unlock(&((stress_state_t *)context)->rwlock);
+}
+
+static uint32_t next_rand(uint32_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+/**
+ * @brief 记录内容: 前2字节为tag，其余字节都等于本次写入的序号，读到混合内容说明不一致
+ * */
+static void fill_value(uint8_t *value, uint16_t tag, uint8_t sequence) {
+    memcpy(value, &tag, sizeof(uint16_t));
+    memset((value + sizeof(uint16_t)), sequence, (STRESS_VALUE_SIZE - sizeof(uint16_t)));
+}
+
+static int check_value(const uint8_t *value, uint16_t tag) {
+    if(memcmp(value, &tag, sizeof(uint16_t)) != 0) {
+        return 0;
+    }
+    for(uint32_t i = sizeof(uint16_t) + 1; i < STRESS_VALUE_SIZE; i++) {
+        if(value[i] != value[sizeof(uint16_t)]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+typedef struct _reader_arg {
+    stress_state_t *state;
+    uint32_t id;
+} reader_arg_t;
+
+static void *reader_main(void *arg) {
+    reader_arg_t *reader = (reader_arg_t *)arg;
+    stress_state_t *state = reader->state;
+    uint8_t value[STRESS_VALUE_SIZE];
+    uint32_t seed = 0x9E3779B9u * (reader->id + 1);
+    uint16_t tag, length;
+
+    while(state->running) {
+        tag = (uint16_t)(next_rand(&seed) % STRESS_TAGS);
+        length = sizeof(value);
+        if(!flash_tlv_get(&state->store, tag, value, &length) || (length != STRESS_VALUE_SIZE) ||
+           !check_value(value, tag)) {
+            state->mismatches[reader->id]++;
+        }
+        state->read_ops[reader->id]++;
+    }
+    return NULL;
+}
+
+static void *writer_main(void *arg) {
+    stress_state_t *state = (stress_state_t *)arg;
+    uint8_t value[STRESS_VALUE_SIZE];
+    uint32_t seed = 0x12345678;
+    uint16_t tag;
+
+    while(state->running) {
+        tag = (uint16_t)(next_rand(&seed) % STRESS_TAGS);
+        fill_value(value, tag, (uint8_t)state->write_ops);
+        flash_tlv_append(&state->store, tag, value, sizeof(value));
+        flash_tlv_gc_step(&state->store, 8);
+        state->write_ops++;
+        sleep_us(STRESS_WRITE_GAP_US);
+    }
+    return NULL;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void stress_run(stress_lock_t mode, uint16_t readers, uint32_t duration_ms) {
+    static stress_state_t state;
+    flash_dev_t dev;
+    tlv_lock_t lock;
+    pthread_rwlockattr_t attr;
+    pthread_t writer, threads[STRESS_READERS_MAX];
+    reader_arg_t args[STRESS_READERS_MAX];
+    uint8_t value[STRESS_VALUE_SIZE];
+    uint32_t size = (STRESS_SECTOR_COUNT * STRESS_SECTOR_SIZE);
+    uint64_t reads = 0, mismatches = 0, elapsed;
+
+    memset(&state, 0x00, sizeof(state));
+    dev.read = bus_read;
+    dev.write = bus_write;
+    dev.erase = bus_erase;
+    // 不提供直接访问指针，所有读取都经过bus_read
+    dev.pointer = NULL;
+    dev.clock = NULL;
+    dev.context = malloc(size);
+    dev.size = size;
+    memset(dev.context, 0xFF, size);
+    pthread_mutex_init(&state.mutex, NULL);
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    // glibc默认读优先，读线程持续持锁时写线程会饿死
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&state.rwlock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    flash_tlv_init_ring(&state.store, &dev, 0, STRESS_SECTOR_COUNT, STRESS_SECTOR_SIZE);
+    if(mode == LOCK_MUTEX) {
+        lock.read_lock = mutex_lock;
+        lock.read_unlock = mutex_unlock;
+        lock.write_lock = mutex_lock;
+        lock.write_unlock = mutex_unlock;
+    }else {
+        lock.read_lock = rwlock_read;
+        lock.read_unlock = rwlock_unlock;
+        lock.write_lock = rwlock_write;
+        lock.write_unlock = rwlock_unlock;
+    }
+    lock.context = &state;
+    flash_tlv_set_lock(&state.store, &lock);
+    for(uint16_t tag = 0; tag < STRESS_TAGS; tag++) {
+        fill_value(value, tag, 0);
+        flash_tlv_append(&state.store, tag, value, sizeof(value));
+    }
+
+    state.running = 1;
+    pthread_create(&writer, NULL, writer_main, &state);
+    for(uint32_t i = 0; i < readers; i++) {
+        args[i].state = &state;
+        args[i].id = i;
+        pthread_create(&threads[i], NULL, reader_main, &args[i]);
+    }
+    elapsed = now_ns();
+    sleep_us(duration_ms * 1000);
+    state.running = 0;
+    for(uint32_t i = 0; i < readers; i++) {
+        pthread_join(threads[i], NULL);
+        reads += state.read_ops[i];
+        mismatches += state.mismatches[i];
+    }
+    pthread_join(writer, NULL);
+    elapsed = now_ns() - elapsed;
+
+    printf("%s,%u,%.1f,%.1f,%llu\n", (mode == LOCK_MUTEX) ? "mutex" : "rwlock", readers,
+           reads * 1e9 / elapsed, state.write_ops * 1e9 / elapsed, (unsigned long long)mismatches);
+
+    pthread_mutex_destroy(&state.mutex);
+    pthread_rwlock_destroy(&state.rwlock);
+    free(dev.context);
+}
+
+int main(int argc, char **argv) {
+    uint32_t duration_ms = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : 500;
+
+    printf("lock,readers,read_ops_s,write_ops_s,mismatches\n");
+    for(uint32_t m = LOCK_MUTEX; m <= LOCK_RWLOCK; m++) {
+        for(uint32_t i = 0; i < sizeof(reader_counts) / sizeof(reader_counts[0]); i++) {
+            stress_run((stress_lock_t)m, reader_counts[i], duration_ms);
+        }
+    }
+    return 0;
+}
@@ -5,24 +5,41 @@
 #include "flash_tlv.h"
 
 static void test_append(tlv_sector_t *sec);
-static void test_gc(tlv_sector_t *sec);
+static void test_gc(void);
 static void test_read(tlv_sector_t *sec);
 static void test_delete(tlv_sector_t *sec);
+static void test_batch(tlv_sector_t *sec);
+static void test_foreach(tlv_sector_t *sec);
+#if FLASH_TLV_USE_SUMMARY
+static void test_summary(void);
+#endif
+#if FLASH_TLV_USE_STREAM
+static void test_stream(void);
+#endif
+#if FLASH_TLV_USE_DELTA
+static void test_patch(void);
+#endif
+#if FLASH_TLV_USE_COMPRESS
+static void test_packed(void);
+#endif
 
 int main(int argc, char **argv) {
     tlv_sector_t tlvSector;
+    flash_dev_t flash;
 
-    flash_create();
-    //flash_import("G:\\ramdisk.bin");
+    flash_create(&flash, 8192);
 
     printf("flash_tlv_init\n");
-    flash_tlv_init(&tlvSector, 0x0, 0x1000, 4096);
+    flash_tlv_init(&tlvSector, &flash, 0x0, 0x1000, 4096);
 
     printf("test_append\n");
     test_append(&tlvSector);
 
+    printf("test_batch\n");
+    test_batch(&tlvSector);
+
     printf("test_gc\n");
-    test_gc(&tlvSector);
+    test_gc();
 
     printf("test_read\n");
     test_read(&tlvSector);
@@ -30,9 +47,43 @@ int main(int argc, char **argv) {
     printf("test_delete\n");
     test_delete(&tlvSector);
 
-    flash_export("G:\\ramdisk.bin");
+    printf("test_foreach\n");
+    test_foreach(&tlvSector);
+
+#if FLASH_TLV_USE_SUMMARY
+    printf("test_summary\n");
+    test_summary();
+#endif
+
+#if FLASH_TLV_USE_DELTA
+    printf("test_patch\n");
+    test_patch();
+#endif
+
+#if FLASH_TLV_USE_COMPRESS
+    printf("test_packed\n");
+    test_packed();
+#endif
+
+#if FLASH_TLV_USE_STREAM
+    printf("test_stream\n");
+    test_stream();
+#endif
 
-    flash_delete();
+#if FLASH_TLV_USE_STATS
+    tlv_stats_t stats;
+    flash_tlv_stats(&tlvSector, &stats);
+    printf("stats: read:%d, write:%d, erase:%d, cache hit:%d/%d, gc:%d, live:%d, dirty:%d, free:%d\n",
+           stats.flash_reads, stats.flash_writes, stats.flash_erases, stats.cache_hits,
+           (stats.cache_hits + stats.cache_misses), stats.gc_count, stats.live_bytes, stats.dirty_bytes, stats.free_bytes);
+#endif
+
+    // 指定路径时导出Flash镜像
+    if(argc > 1) {
+        flash_export(&flash, argv[1]);
+    }
+
+    flash_delete(&flash);
 
     return 0;
 }
@@ -50,12 +101,33 @@ static void test_append(tlv_sector_t *sec) {
     flash_tlv_append(sec, 0xCC69, buffer, 4);
 }
 
-static void test_gc(tlv_sector_t *sec) {
+static void test_gc(void) {
+    tlv_sector_t sec;
+    flash_dev_t flash;
     uint8_t bufferExt[16];
-    for(int i = 0; i < 166; i++) {
+    int steps = 0;
+
+    // 独立的4扇区存储，反复覆盖16个tag，写满到只剩一个空闲扇区，最旧扇区中大部分是旧值
+    flash_create(&flash, 16384);
+    flash_tlv_init_ring(&sec, &flash, 0x0, 4, 4096);
+    for(int i = 0; i < 470; i++) {
         memset(bufferExt, i, 16);
-        flash_tlv_append(sec, i, bufferExt, 16);
+        flash_tlv_append(&sec, (uint16_t)(i % 16), bufferExt, 16);
     }
+#if FLASH_TLV_USE_STATS
+    tlv_stats_t before, after;
+    flash_tlv_stats(&sec, &before);
+#endif
+    // 空闲时分步整理，每次最多处理8条记录
+    while(flash_tlv_gc_step(&sec, 8)) {
+        steps++;
+    }
+    printf("gc steps:%d\n", steps);
+#if FLASH_TLV_USE_STATS
+    flash_tlv_stats(&sec, &after);
+    printf("gc reclaimed bytes:%d, free:%d\n", (before.dirty_bytes - after.dirty_bytes), after.free_bytes);
+#endif
+    flash_delete(&flash);
 }
 
 static void test_read(tlv_sector_t *sec) {
@@ -66,12 +138,12 @@ static void test_read(tlv_sector_t *sec) {
     result = flash_tlv_query(sec, 0x1122, &block);
     printf("query result:%d\n", result);
 
-    result = flash_tlv_verify( &block);
+    result = flash_tlv_verify(sec, &block);
     printf("verify result:%d\n", result);
 
     buffer = (uint8_t *)malloc(block.length);
 
-    uint32_t read = flash_tlv_read(&block, buffer, 0, block.length);
+    uint32_t read = flash_tlv_read(sec, &block, buffer, 0, block.length);
     printf("read bytes:%d\n", read);
 
     printf("read data: \"");
@@ -81,9 +153,249 @@ static void test_read(tlv_sector_t *sec) {
     printf("\"\n");
 
     free(buffer);
+
+    // 零拷贝读取，RAM/mmap后端支持直接访问
+    uint16_t length;
+    const uint8_t *data = flash_tlv_get_ptr(sec, &block, &length);
+    if(data != NULL) {
+        printf("mapped data: \"%.*s\"\n", length, data);
+    }
 }
 
 static void test_delete(tlv_sector_t *sec) {
     bool result = flash_tlv_delete(sec, 0xCC69);
     printf("delete result:%d\n", result);
 }
+
+static void test_batch(tlv_sector_t *sec) {
+    const uint8_t profile[3][4] = {
+        {0x01, 0x02, 0x03, 0x04},
+        {0x11, 0x12, 0x13, 0x14},
+        {0x21, 0x22, 0x23, 0x24},
+    };
+    tlv_item_t items[3];
+    tlv_block_t block;
+
+    for(int i = 0; i < 3; i++) {
+        items[i].tag = 0x2000 + i;
+        items[i].length = 4;
+        items[i].data = profile[i];
+    }
+    bool result = flash_tlv_append_batch(sec, items, 3);
+    printf("batch result:%d\n", result);
+
+    result = flash_tlv_query(sec, 0x2002, &block);
+    printf("query batch result:%d, verify:%d\n", result, flash_tlv_verify(sec, &block));
+}
+
+static bool print_record(const tlv_block_t *block, const uint8_t *data, void *context) {
+    (void)context;
+    printf("tag:0x%04x, length:%d, data:", block->tag, block->length);
+    for(int i = 0; i < block->length; i++) {
+        printf("%02x", data[i]);
+    }
+    printf("\n");
+    return true;
+}
+
+static void test_foreach(tlv_sector_t *sec) {
+    uint8_t buffer[64];
+    // 只输出批量写入的记录
+    uint32_t count = flash_tlv_foreach(sec, 0x2000, 0x20FF, buffer, sizeof(buffer), print_record, NULL);
+    printf("foreach count:%d\n", count);
+}
+
+#if FLASH_TLV_USE_SUMMARY
+typedef struct {
+    uint32_t count;
+    uint32_t check;
+} live_set_t;
+
+static bool sum_record(const tlv_block_t *block, const uint8_t *data, void *context) {
+    live_set_t *set = (live_set_t *)context;
+    set->count++;
+    set->check = (set->check * 31) + block->tag + block->length;
+    for(int i = 0; i < block->length; i++) {
+        set->check = (set->check * 31) + data[i];
+    }
+    return true;
+}
+
+static void test_summary(void) {
+    tlv_sector_t sec, remount;
+    flash_dev_t flash;
+    live_set_t before = {0}, after = {0};
+    uint8_t buffer[64];
+
+    // 独立的4扇区存储，反复覆盖和删除使整理写入摘要，重新挂载后有效记录集合应与挂载前相同
+    flash_create(&flash, 16384);
+    flash_tlv_init_ring(&sec, &flash, 0x0, 4, 4096);
+    for(int i = 0; i < 1500; i++) {
+        memset(buffer, i, sizeof(buffer));
+        flash_tlv_append(&sec, (uint16_t)(i % 40), buffer, (uint16_t)(8 + (i % 7) * 8));
+        if((i % 11) == 0) {
+            flash_tlv_delete(&sec, (uint16_t)((i / 11) % 40));
+        }
+    }
+    flash_tlv_foreach(&sec, 0x0000, 0xFFFF, buffer, sizeof(buffer), sum_record, &before);
+
+    flash_tlv_init_ring(&remount, &flash, 0x0, 4, 4096);
+    flash_tlv_foreach(&remount, 0x0000, 0xFFFF, buffer, sizeof(buffer), sum_record, &after);
+    bool result = (before.count == after.count) && (before.check == after.check);
+#if FLASH_TLV_USE_STATS
+    tlv_stats_t stats, remount_stats;
+    flash_tlv_stats(&sec, &stats);
+    flash_tlv_stats(&remount, &remount_stats);
+    result = result && (stats.live_bytes == remount_stats.live_bytes) &&
+             (stats.dirty_bytes == remount_stats.dirty_bytes);
+#endif
+    printf("summary remount records:%d, result:%d\n", after.count, result);
+    flash_delete(&flash);
+}
+#endif
+
+#if FLASH_TLV_USE_STREAM
+// 模拟掉电: 整理标记原分段删除时断电，之后的写入和擦除都不生效
+static void (*flash_write_raw)(flash_dev_t *dev, uint32_t addr, uint32_t length, const uint8_t *buffer);
+static void (*flash_erase_raw)(flash_dev_t *dev, uint32_t addr, uint32_t size);
+static bool power_armed, power_lost;
+
+static void cut_write(flash_dev_t *dev, uint32_t addr, uint32_t length, const uint8_t *buffer) {
+    uint16_t header;
+    if(power_armed && !power_lost && (length == 1) && (buffer[0] == TLV_STATE_DELETE)) {
+        dev->read(dev, (addr - 2), sizeof(header), (uint8_t *)&header);
+        power_lost = (header == HEADER_PART_TLV);
+    }
+    if(!power_lost) {
+        flash_write_raw(dev, addr, length, buffer);
+    }
+}
+
+static void cut_erase(flash_dev_t *dev, uint32_t addr, uint32_t size) {
+    if(!power_lost) {
+        flash_erase_raw(dev, addr, size);
+    }
+}
+
+static uint32_t read_stream(tlv_sector_t *sec, uint16_t tag, bool *check) {
+    tlv_stream_t stream;
+    uint8_t chunk[100];
+    uint32_t total = 0, read;
+
+    *check = false;
+    if(flash_tlv_read_begin(sec, &stream, tag)) {
+        while((read = flash_tlv_read_chunk(&stream, chunk, sizeof(chunk))) != 0) {
+            total += read;
+        }
+        *check = flash_tlv_read_end(&stream);
+    }
+    return total;
+}
+
+static void test_stream(void) {
+    tlv_sector_t sec, remount;
+    flash_dev_t flash;
+    tlv_stream_t stream;
+    uint8_t chunk[100];
+    uint32_t total;
+    bool result, check;
+
+    // 独立的4扇区存储，6000字节的值跨越两个扇区，每次只提供100字节
+    flash_create(&flash, 16384);
+    flash_tlv_init_ring(&sec, &flash, 0x0, 4, 4096);
+    result = flash_tlv_write_begin(&sec, &stream, 0x3000, 6000);
+    for(int i = 0; result && (i < 60); i++) {
+        memset(chunk, i, sizeof(chunk));
+        result = flash_tlv_write_chunk(&stream, chunk, sizeof(chunk));
+    }
+    result = result && flash_tlv_write_end(&stream);
+    printf("stream write result:%d\n", result);
+
+    total = read_stream(&sec, 0x3000, &check);
+    printf("stream read bytes:%d, check:%d\n", total, check);
+
+    // 覆盖写入其他tag直到开始整理分段所在的扇区，复制第一条分段后、标记原分段删除时掉电
+    flash_write_raw = flash.write;
+    flash_erase_raw = flash.erase;
+    flash.write = cut_write;
+    flash.erase = cut_erase;
+    for(int i = 0; !power_lost && (i < 200); i++) {
+        memset(chunk, i, sizeof(chunk));
+        flash_tlv_append(&sec, (uint16_t)(0x3100 + (i % 4)), chunk, sizeof(chunk));
+        power_armed = true;
+        flash_tlv_gc_step(&sec, 1);
+        power_armed = false;
+    }
+    flash.write = flash_write_raw;
+    flash.erase = flash_erase_raw;
+
+    // 重新上电挂载，恢复整理时丢弃已复制过的分段，整理能够完成且值仍完整
+    flash_tlv_init_ring(&remount, &flash, 0x0, 4, 4096);
+    int steps = 0;
+    while((steps < 100) && flash_tlv_gc_step(&remount, 8)) {
+        steps++;
+    }
+    total = read_stream(&remount, 0x3000, &check);
+    printf("stream power lost:%d, gc done:%d, remount read bytes:%d, check:%d\n", power_lost, (steps < 100), total,
+           check);
+    flash_delete(&flash);
+}
+#endif
+
+#if FLASH_TLV_USE_DELTA
+static void test_patch(void) {
+    tlv_sector_t sec;
+    flash_dev_t flash;
+    tlv_block_t block;
+    uint8_t buffer[64];
+    char text[] = "config:0000";
+    bool result;
+
+    // 独立的存储，只改写末尾4个字节，再追加一段，读出时合并增量
+    flash_create(&flash, 8192);
+    flash_tlv_init(&sec, &flash, 0x0, 0x1000, 4096);
+    flash_tlv_append(&sec, 0x4000, (const uint8_t *)text, strlen(text));
+    result = flash_tlv_patch(&sec, 0x4000, 7, (const uint8_t *)"1234", 4);
+    result = result && flash_tlv_extend(&sec, 0x4000, (const uint8_t *)";ok", 3);
+    printf("patch result:%d\n", result);
+
+    if(flash_tlv_query(&sec, 0x4000, &block)) {
+        uint32_t read = flash_tlv_read(&sec, &block, buffer, 0, block.length);
+        printf("patch value:%.*s, verify:%d\n", (int)read, buffer, flash_tlv_verify(&sec, &block));
+    }
+    flash_delete(&flash);
+}
+#endif
+
+#if FLASH_TLV_USE_COMPRESS
+static void test_packed(void) {
+    tlv_sector_t sec;
+    flash_dev_t flash;
+    tlv_block_t block;
+    uint8_t buffer[32];
+    char text[160];
+    uint16_t length = 0;
+    bool result;
+
+    // 独立的存储，重复字段的文本压缩后写入，只读出中间一段
+    for(int i = 0; i < 8; i++) {
+        length += (uint16_t)sprintf(&text[length], "{\"ch\":%d,\"on\":1},", i);
+    }
+    flash_create(&flash, 8192);
+    flash_tlv_init(&sec, &flash, 0x0, 0x1000, 4096);
+    result = flash_tlv_append_packed(&sec, 0x5000, (const uint8_t *)text, length);
+    printf("packed result:%d\n", result);
+
+    if(flash_tlv_query(&sec, 0x5000, &block)) {
+        uint32_t read = flash_tlv_read(&sec, &block, buffer, 30, 15);
+        printf("packed length:%d, read:%.*s, verify:%d\n", block.length, (int)read, buffer,
+               flash_tlv_verify(&sec, &block));
+    }
+#if FLASH_TLV_USE_STATS
+    tlv_stats_t stats;
+    flash_tlv_stats(&sec, &stats);
+    printf("packed saved:%d\n", stats.packed_saved);
+#endif
+    flash_delete(&flash);
+}
+#endif
@@ -6,39 +6,23 @@
 #include "string.h"
 #include "stdio.h"
 
-static uint8_t *mem;
-
-void flash_create() {
-    mem = malloc(8192);
-    printf("flash::malloc 8192 bytes\n");
-}
-
-void flash_import(const char *filepath) {
-    FILE *file = fopen(filepath, "rb+");
-    fread(mem, 8192, 1, file);
-    fclose(file);
-    printf("flash::import from: %s\n", filepath);
-}
-
-void flash_export(const char *filepath) {
-    FILE *file = fopen(filepath, "wb+");
-    fwrite(mem, 8192, 1, file);
-    fclose(file);
-    printf("flash::export at: %s\n", filepath);
-}
-
-void flash_delete() {
-    free(mem);
-    printf("flash::deleted\n");
-}
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define FLASH_USE_MMAP    1
+#else
+#define FLASH_USE_MMAP    0
+#endif
 
 /**
  * @brief Flash擦除
  * @param addr 擦除的起始地址
  * @param size 擦除的大小(bytes)
  * */
-void flash_erase(uint32_t addr, uint32_t size) {
-    memset(mem + addr, 0xFF, size);
+static void mem_erase(flash_dev_t *dev, uint32_t addr, uint32_t size) {
+    memset((uint8_t *)dev->context + addr, 0xFF, size);
     printf("flash::erase %08x, size:%d\n", addr, size);
 }
 
@@ -49,8 +33,8 @@ void flash_erase(uint32_t addr, uint32_t size) {
  * @param length 写入的长度(bytes)
  * @param buffer 写入的数据
  * */
-void flash_write(uint32_t addr, uint32_t length, const uint8_t *buffer) {
-    memcpy(mem + addr, buffer, length);
+static void mem_write(flash_dev_t *dev, uint32_t addr, uint32_t length, const uint8_t *buffer) {
+    memcpy((uint8_t *)dev->context + addr, buffer, length);
 }
 
 /**
@@ -59,6 +43,105 @@ void flash_write(uint32_t addr, uint32_t length, const uint8_t *buffer) {
  * @param length 读取的长度(bytes)
  * @param buffer 存放读出的数据
  * */
-void flash_read(uint32_t addr, uint32_t length, uint8_t *buffer) {
-    memcpy(buffer, mem + addr,length);
+static void mem_read(flash_dev_t *dev, uint32_t addr, uint32_t length, uint8_t *buffer) {
+    memcpy(buffer, (uint8_t *)dev->context + addr, length);
+}
+
+static const uint8_t *mem_pointer(flash_dev_t *dev, uint32_t addr) {
+    return ((const uint8_t *)dev->context + addr);
+}
+
+static void mem_bind(flash_dev_t *dev, uint8_t *mem, uint32_t size) {
+    dev->read = mem_read;
+    dev->write = mem_write;
+    dev->erase = mem_erase;
+    dev->pointer = mem_pointer;
+    dev->clock = NULL;
+    dev->context = mem;
+    dev->size = size;
+}
+
+/**
+ * @brief 创建RAM模拟Flash，初始内容为擦除状态
+ * @param size 模拟Flash容量(bytes)
+ * */
+void flash_create(flash_dev_t *dev, uint32_t size) {
+    uint8_t *mem = malloc(size);
+    memset(mem, 0xFF, size);
+    mem_bind(dev, mem, size);
+    printf("flash::malloc %d bytes\n", size);
+}
+
+void flash_import(flash_dev_t *dev, const char *filepath) {
+    FILE *file = fopen(filepath, "rb+");
+    fread(dev->context, dev->size, 1, file);
+    fclose(file);
+    printf("flash::import from: %s\n", filepath);
+}
+
+void flash_export(flash_dev_t *dev, const char *filepath) {
+    FILE *file = fopen(filepath, "wb+");
+    fwrite(dev->context, dev->size, 1, file);
+    fclose(file);
+    printf("flash::export at: %s\n", filepath);
+}
+
+void flash_delete(flash_dev_t *dev) {
+    free(dev->context);
+    dev->context = NULL;
+    printf("flash::deleted\n");
+}
+
+/**
+ * @brief 把Flash镜像文件映射到内存，读写直接作用于文件，不需要整体导入导出
+ * @note 文件不存在时创建，小于size时扩展，扩展部分为擦除状态(0xFF)
+ * @param filepath 镜像文件路径
+ * @param size 设备容量(bytes)
+ * @return true:映射成功，false:文件无法打开或平台不支持mmap
+ * */
+bool flash_open(flash_dev_t *dev, const char *filepath, uint32_t size) {
+#if FLASH_USE_MMAP
+    struct stat st;
+    uint8_t *mem;
+    int fd = open(filepath, O_RDWR | O_CREAT, 0644);
+
+    if(fd < 0) {
+        return false;
+    }
+    if((fstat(fd, &st) != 0) || ((st.st_size < size) && (ftruncate(fd, size) != 0))) {
+        close(fd);
+        return false;
+    }
+    mem = mmap(NULL, size, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+    // 映射建立后文件描述符不再需要
+    close(fd);
+    if(mem == MAP_FAILED) {
+        return false;
+    }
+    if(st.st_size < size) {
+        memset(mem + st.st_size, 0xFF, (size - st.st_size));
+    }
+    mem_bind(dev, mem, size);
+    printf("flash::mmap %s, size:%d\n", filepath, size);
+    return true;
+#else
+    (void)dev;
+    (void)filepath;
+    (void)size;
+    return false;
+#endif
+}
+
+/**
+ * @brief 同步并解除文件映射
+ * */
+void flash_close(flash_dev_t *dev) {
+#if FLASH_USE_MMAP
+    msync(dev->context, dev->size, MS_SYNC);
+    munmap(dev->context, dev->size);
+    dev->context = NULL;
+    printf("flash::unmapped\n");
+#else
+    (void)dev;
+#endif
 }
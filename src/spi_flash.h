@@ -6,16 +6,39 @@
 #define FLASHTLV_SPI_FLASH_H
 
 #include "stdint.h"
+#include <stdbool.h>
 
 #define FLASH_PAGE_SIZE    0x1000
 
-void flash_create();
-void flash_import(const char *filepath);
-void flash_export(const char *filepath);
-void flash_delete();
+typedef struct _flash_dev flash_dev_t;
 
-void flash_erase(uint32_t addr, uint32_t size);
-void flash_write(uint32_t addr, uint32_t length, const uint8_t *buffer);
-void flash_read(uint32_t addr, uint32_t length, uint8_t *buffer);
+/**
+ * @brief Flash后端操作接口，flash_tlv通过它访问存储设备，同一进程可同时驱动多个设备
+ * @note read/write/erase必须实现，pointer可选(不支持直接访问时为NULL)
+ * */
+struct _flash_dev {
+    void (*read)(flash_dev_t *dev, uint32_t addr, uint32_t length, uint8_t *buffer);
+    // 写入前需要保证地址对应的扇区擦除过
+    void (*write)(flash_dev_t *dev, uint32_t addr, uint32_t length, const uint8_t *buffer);
+    void (*erase)(flash_dev_t *dev, uint32_t addr, uint32_t size);
+    // 返回addr处数据的直接访问指针(内存或内存映射)，用于零拷贝读取
+    const uint8_t *(*pointer)(flash_dev_t *dev, uint32_t addr);
+    // 可选，微秒时钟，用于统计操作耗时
+    uint32_t (*clock)(flash_dev_t *dev);
+    // 后端私有数据，RAM/文件后端为存储区首地址
+    void *context;
+    // 设备容量(bytes)
+    uint32_t size;
+};
+
+// RAM后端
+void flash_create(flash_dev_t *dev, uint32_t size);
+void flash_import(flash_dev_t *dev, const char *filepath);
+void flash_export(flash_dev_t *dev, const char *filepath);
+void flash_delete(flash_dev_t *dev);
+
+// 文件映射后端(mmap)，Flash镜像直接映射到内存，修改直接写回文件
+bool flash_open(flash_dev_t *dev, const char *filepath, uint32_t size);
+void flash_close(flash_dev_t *dev);
 
 #endif //FLASHTLV_SPI_FLASH_H
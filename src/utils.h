@@ -7,9 +7,23 @@
 #define _UTILS_H_
 
 #include "stdint.h"
+#include "stddef.h"
+
+// 查表CRC每次处理的字节数: 1, 4或8，查表占用UTILS_CRC_SLICE * 256字节(CRC8)和UTILS_CRC_SLICE * 1KB(CRC32C)
+#define UTILS_CRC_SLICE    8
+// 编译目标支持时使用硬件CRC32C指令(x86 SSE4.2 / ARMv8 CRC扩展)，主机工具使用
+#ifndef UTILS_CRC_HW
+#define UTILS_CRC_HW       0
+#endif
+
+#if (UTILS_CRC_SLICE != 1) && (UTILS_CRC_SLICE != 4) && (UTILS_CRC_SLICE != 8)
+#error "UTILS_CRC_SLICE must be 1, 4 or 8"
+#endif
 
 uint32_t calc_crc32(uint32_t crc, const void *buffer, size_t size);
 
+uint32_t calc_crc32c(uint32_t crc, const void *buffer, size_t size);
+
 unsigned char calc_crc8(unsigned char init, const unsigned char *data, unsigned int len);
 
 #endif /* EXAMPLES_BLE_EPD_SRC_UTILS_H_ */